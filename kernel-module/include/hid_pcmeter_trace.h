@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints of the pcmeter driver, e.g.
+ * perf trace -e 'hid_pcmeter:*' or /sys/kernel/tracing/events/hid_pcmeter/
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hid_pcmeter
+
+#if !defined(_HID_PCMETER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HID_PCMETER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* one pass of the sampler over all online CPUs, for all devices */
+TRACE_EVENT(pcmeter_sample,
+	TP_PROTO(unsigned int cpus, u64 duration_ns, u16 load_q8),
+	TP_ARGS(cpus, duration_ns, load_q8),
+	TP_STRUCT__entry(
+		__field(unsigned int, cpus)
+		__field(u64, duration_ns)
+		__field(u16, load_q8)
+	),
+	TP_fast_assign(
+		__entry->cpus = cpus;
+		__entry->duration_ns = duration_ns;
+		__entry->load_q8 = load_q8;
+	),
+	TP_printk("cpus=%u duration=%lluns load=%u.%02u%%",
+		  __entry->cpus, __entry->duration_ns,
+		  __entry->load_q8 >> 8, (__entry->load_q8 & 0xff) * 100 / 256)
+);
+
+/* one report done, from handing it to the device until it was written */
+TRACE_EVENT(pcmeter_send,
+	TP_PROTO(unsigned int dev, u8 report, int ret, u64 duration_ns),
+	TP_ARGS(dev, report, ret, duration_ns),
+	TP_STRUCT__entry(
+		__field(unsigned int, dev)
+		__field(u8, report)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+	TP_fast_assign(
+		__entry->dev = dev;
+		__entry->report = report;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+	TP_printk("dev=%u report=0x%02x ret=%d duration=%lluns",
+		  __entry->dev, __entry->report, __entry->ret,
+		  __entry->duration_ns)
+);
+
+#endif /* _HID_PCMETER_TRACE_H */
+
+/* the header is found through -I$(HEADERS) */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hid_pcmeter_trace
+#include <trace/define_trace.h>
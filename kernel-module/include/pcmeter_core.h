@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * The arithmetic of the pcmeter driver: loads, shares and when to send.
+ * Nothing in here touches the kernel, src/pcmeter_core.c builds into the
+ * module and as a library on the host (make host).
+ */
+
+#ifndef PCMETER_CORE_H_
+#define PCMETER_CORE_H_
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/* limits of the send interval in ms */
+#define INTERVAL_MIN		10
+#define INTERVAL_MAX		60000
+
+/* time a CPU has spent so far, in ns */
+struct pcmeter_cpu_sample {
+	uint64_t busy;
+	uint64_t idle;       /* idle and iowait */
+	uint64_t iowait;
+	uint64_t steal;
+	uint64_t irq;
+	uint64_t softirq;
+};
+
+static inline uint8_t pcmeter_q8_to_u8(uint16_t v)
+{
+	return v >> 8;
+}
+
+/* share of elapsed that was not idle, percent in Q8.8 */
+uint16_t pcmeter_busy_q8(uint64_t idle, uint64_t elapsed);
+
+/* share of elapsed that part was, percent in Q8.8 */
+uint16_t pcmeter_share_q8(uint64_t part, uint64_t elapsed);
+
+/* what is not available of total, percent in Q8.8. Nothing in total is full. */
+uint16_t pcmeter_used_q8(uint64_t available, uint64_t total);
+
+/*
+ * Add the time a CPU spent between two samples to spent.
+ * Returns the load of the CPU in that time, percent in Q8.8.
+ */
+uint16_t pcmeter_cpu_delta(const struct pcmeter_cpu_sample *now,
+			   const struct pcmeter_cpu_sample *last,
+			   struct pcmeter_cpu_sample *spent);
+
+/* where the time of all CPUs went, at their bytes of the kernel report */
+void pcmeter_kernel_shares(const struct pcmeter_cpu_sample *spent, uint16_t *kern);
+
+/*
+ * Biggest change of a value in percent against the reference values.
+ * sys has 3 values, kern PCM_REPORT_SIZE.
+ */
+int pcmeter_max_delta(const uint16_t *sys, const uint16_t *kern, const uint8_t *cores,
+		      const uint16_t *sys_ref, const uint16_t *kern_ref, const uint8_t *cores_ref,
+		      int ncores);
+
+/*
+ * The next period of a device in ms: half of it while the loads jump,
+ * longer while they are steady, from a quarter of the interval up to four
+ * times it. Never longer than the keepalive, unless the interval itself is.
+ */
+unsigned int pcmeter_adapt_period(unsigned int period, unsigned int interval,
+				  unsigned int keepalive, int threshold, int moved,
+				  bool adaptive);
+
+/*
+ * Whether a report has to go out now, since_send ms after the last one,
+ * because the next tick in period ms would be at or past the keepalive.
+ * Waiting for the tick that passes it would leave the firmware without a
+ * report for up to another period, ticks may also come a little early.
+ */
+bool pcmeter_keepalive_due(unsigned int since_send, unsigned int period,
+			   unsigned int keepalive);
+
+#endif /* PCMETER_CORE_H_ */
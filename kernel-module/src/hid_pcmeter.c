@@ -7,6 +7,8 @@
  */
 
 #include "core.h"
+#include "pcmeter_protocol.h"
+#include "pcmeter_core.h"
 #include <linux/hid.h>
 #include <linux/hidraw.h>
 #include <linux/mutex.h>
@@ -18,10 +20,38 @@
 #include <linux/cpumask.h>
 #include <linux/tick.h>
 #include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/vmstat.h>
+#include <linux/nodemask.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/usb.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+
+#define CREATE_TRACE_POINTS
+#include "hid_pcmeter_trace.h"
 
 #define USB_VENDOR_ID_PC_METER_PICO 0x2e8a
 #define USB_DEVICE_ID_PC_METER_PICO 0xc011
-#define MAX_REPORT_SIZE		64
+#define MAX_REPORT_SIZE		PCM_REPORT_SIZE
+/* per-core loads are at bytes 10-63 of the system report */
+#define MAX_REPORT_CORES	(MAX_REPORT_SIZE - PCM_SYS_CORE0)
+#define HIST_BUCKETS		16
+/*
+ * report buffers per device, a tick takes at most a frame of
+ * PCM_CORES_PARTS_MAX reports and the kernel report, two ticks fit
+ */
+#define TX_SLOTS		(2 * PCM_CORES_PARTS_MAX)
+/*
+ * A report buffer starts TX_ALIGN - 1 bytes into its slot, so what an URB
+ * sends after the report id starts on a TX_ALIGN boundary. The URBs use
+ * URB_NO_TRANSFER_DMA_MAP, nothing would bounce an odd address for the
+ * controllers that need aligned DMA, like dwc2.
+ */
+#define TX_ALIGN		32
+#define TX_SLOT_SIZE		ALIGN(TX_ALIGN - 1 + MAX_REPORT_SIZE, TX_ALIGN)
 
 enum hidpcmeter_report_type {
     RAW_REQUEST,
@@ -33,6 +63,7 @@ enum hidpcmeter_type {
 };
 
 struct hidpcmeter_device;
+struct pcmeter_snapshot;
 
 struct hidpcmeter_config {
 	enum hidpcmeter_type      	type;
@@ -40,73 +71,299 @@ struct hidpcmeter_config {
 	const char          		*short_name;
 	size_t          			report_size;
 	enum hidpcmeter_report_type	report_type;
-	ssize_t (*write)(struct hidpcmeter_device *ldev);
+	unsigned int                interval;       /* ms, 0 takes the interval parameter */
+	u8                          caps;           /* report layouts that may be used, PCM_CAP_* */
+	ssize_t (*write)(struct hidpcmeter_device *ldev, const struct pcmeter_snapshot *snap);
+};
+
+/* powers of two in us: bucket 0 is below 1us, bucket n is 2^(n-1) to 2^n - 1us */
+struct pcmeter_hist {
+	u32 bucket[HIST_BUCKETS];
+};
+
+/* what a device costs, in debugfs */
+struct pcmeter_stats {
+	u64                            ticks;
+	u64                            sent;            /* reports */
+	u64                            skipped;         /* ticks not sent, nothing changed */
+	u64                            errors;
+	u64                            short_writes;
+	u64                            busy;            /* no free report buffer, the device is behind */
+	int                            last_error;
+	struct pcmeter_hist            send;            /* handed to the device until done */
+	struct pcmeter_hist            jitter;          /* tick against the requested time */
+};
+
+/*
+ * The values of one tick. The one of the sampler has what all devices
+ * share, the one of a device also the loads since its own last tick.
+ */
+struct pcmeter_snapshot {
+	u16                            sys[3];          /* system report */
+	u16                            kern[MAX_REPORT_SIZE];   /* kernel report, indexed by byte */
+	int                            kern_len;
+	u16                            ncores;
+	u16                            *core_load;      /* indexed by CPU id */
+	u8                             *core_pct;
+};
+
+/*
+ * One sampler for all devices. It reads every CPU once per tick and hands
+ * the samples to the devices whose period is over, so the CPUs are not
+ * read again for every device. Ticks come as often as the device with the
+ * shortest period needs, every device compares with the samples of its own
+ * last tick, so its loads cover its whole period.
+ */
+struct pcmeter_sampler {
+	struct mutex                   lock;            /* everything below and the devices' ticks */
+	struct list_head               devices;
+	struct delayed_work            work;
+	struct pcmeter_cpu_sample      *cpu_last;       /* of this tick, indexed by CPU id */
+	struct cpumask                 cpu_sampled;     /* CPUs read at this tick */
+	struct pcmeter_snapshot        snap;
+	u64                            samples;
+	struct pcmeter_hist            sample;          /* pass over all CPUs */
+};
+
+/*
+ * A report buffer. Reports are built right in it and it goes to the device
+ * as it is, by an URB of its own or by hid_hw_output_report().
+ */
+struct pcmeter_tx {
+	struct hidpcmeter_device       *ldev;
+	u8                             *buf;
+	dma_addr_t                     dma;
+	struct urb                     *urb;            /* NULL without the URB path */
+	u64                            queued;          /* ns */
 };
 
 struct hidpcmeter_device {
 	const struct hidpcmeter_config *config;
 	struct hid_device              *hdev;
-	bool                           connected;
-	u8			                   *buf;
-	u64                            *cpu_last_idle;
-	struct work_struct             work_arg;
-	int                            interval;
-	struct mutex		           lock;
-	spinlock_t                     slock;
+	struct list_head               node;            /* in sampler.devices */
+	u8			                   *buf;            /* feature requests */
+	struct usb_device              *udev;           /* NULL without the URB path */
+	struct usb_anchor              anchor;          /* URBs on their way */
+	struct pcmeter_tx              tx[TX_SLOTS];    /* used in turn */
+	unsigned int                   tx_next;
+	DECLARE_BITMAP(tx_busy, TX_SLOTS);
+	u8                             caps;
+	u16                            seq;
+	u8                             v2_flags;
+	u8                             *core_sent;      /* as in the last report sent */
+	u8                             *core_prev;      /* as in the last sample */
+	u16                            sys_sent[3];
+	u16                            sys_prev[3];
+	u16                            kern_sent[MAX_REPORT_SIZE];      /* indexed by byte */
+	u16                            kern_prev[MAX_REPORT_SIZE];
+	unsigned long                  last_send;       /* jiffies */
+	u16                            frame;
+	struct pcmeter_cpu_sample      *cpu_last;       /* at the last tick of the device, by CPU id */
+	struct cpumask                 cpu_sampled;     /* CPUs with a valid cpu_last */
+	struct pcmeter_snapshot        snap;            /* of the last tick of the device */
+	unsigned int                   interval;
+	unsigned int                   period;          /* ms until the next tick */
+	u64                            due_ns;          /* when the next tick is */
+	spinlock_t		               lock;            /* all of stats and last_report, taken in URB completions */
+	struct pcmeter_stats           stats;
+	u8                             last_report[MAX_REPORT_SIZE];
+	struct dentry                  *debugfs;
 };
 
-/* send interval in ms */
+/* send interval in ms of new devices, per device it is in sysfs */
 static int interval = 1000;
 module_param(interval,int,0660);
 
-static void pcmeter_work_function(struct work_struct *work_arg)
+/* smallest change of a value in percent that is sent, 0 sends every sample */
+static int threshold = 1;
+module_param(threshold, int, 0644);
+
+/* longest time in ms without a report, must stay below SERIAL_TIMEOUT of the firmware */
+static int keepalive = 1500;
+module_param(keepalive, int, 0644);
+
+/* sample faster while the loads move and slower while they are steady */
+static bool adaptive = true;
+module_param(adaptive, bool, 0644);
+
+/*
+ * The sampler runs here. Unbound because it does not matter which CPU
+ * samples, freezable so nothing is sent while suspending.
+ */
+static struct workqueue_struct *pcmeter_wq;
+
+static struct pcmeter_sampler sampler = {
+	.lock = __MUTEX_INITIALIZER(sampler.lock),
+	.devices = LIST_HEAD_INIT(sampler.devices),
+};
+
+/* /sys/kernel/debug/hid_pcmeter, the sampler and a directory per device in it */
+static struct dentry *pcmeter_debugfs;
+
+static void hist_add(struct pcmeter_hist *hist, u64 ns)
 {
-	struct hidpcmeter_device* ldev = container_of(work_arg, struct hidpcmeter_device, work_arg);
+	hist->bucket[min_t(int, fls64(div_u64(ns, NSEC_PER_USEC)), HIST_BUCKETS - 1)]++;
+}
+
+/* the next report buffer in turn, NULL while it is still on its way to the device */
+static struct pcmeter_tx *pcmeter_tx_get(struct hidpcmeter_device *ldev)
+{
+	unsigned int i = ldev->tx_next;
+
+	/* URBs complete in order, so the next buffer is the oldest one */
+	if (test_and_set_bit_lock(i, ldev->tx_busy)) {
+		spin_lock_irq(&ldev->lock);
+		ldev->stats.busy++;
+		spin_unlock_irq(&ldev->lock);
+		return NULL;
+	}
+	ldev->tx_next = (i + 1) % TX_SLOTS;
+	memset(ldev->tx[i].buf, 0, MAX_REPORT_SIZE);
+
+	return &ldev->tx[i];
+}
+
+/* give a buffer back, sent or not */
+static void pcmeter_tx_put(struct hidpcmeter_device *ldev, struct pcmeter_tx *tx)
+{
+	clear_bit_unlock(tx - ldev->tx, ldev->tx_busy);
+}
+
+/* account a report, ret is the length written or an error */
+static void pcmeter_tx_done(struct hidpcmeter_device *ldev, struct pcmeter_tx *tx, int ret)
+{
+	u64 took = ktime_get_ns() - tx->queued;
 	unsigned long flags;
 
-	if (!ldev) return;
-	spin_lock_irqsave(&ldev->slock, flags);
-	if (!ldev->connected) return ;
-	spin_unlock_irqrestore(&ldev->slock, flags);
+	spin_lock_irqsave(&ldev->lock, flags);
+	hist_add(&ldev->stats.send, took);
+	if (ret < 0) {
+		ldev->stats.errors++;
+		ldev->stats.last_error = ret;
+	} else if (ret != ldev->config->report_size) {
+		ldev->stats.short_writes++;
+	} else {
+		ldev->stats.sent++;
+		memcpy(ldev->last_report, tx->buf, MAX_REPORT_SIZE);
+	}
+	spin_unlock_irqrestore(&ldev->lock, flags);
+	trace_pcmeter_send(ldev->hdev->id, tx->buf[1], ret, took);
 
-	ldev->config->write(ldev);
-	set_current_state(TASK_INTERRUPTIBLE);
-	schedule_timeout(msecs_to_jiffies(ldev->interval));
-	schedule_work(work_arg);
+	pcmeter_tx_put(ldev, tx);
 }
 
-static int hidpcmeter_send(struct hidpcmeter_device *ldev, __u8 *buf)
+static void pcmeter_tx_complete(struct urb *urb)
 {
-	int ret;
+	struct pcmeter_tx *tx = urb->context;
+
+	/* the report id 0 is not sent, see hidpcmeter_tx_init() */
+	pcmeter_tx_done(tx->ldev, tx, urb->status ?: urb->actual_length + 1);
+}
 
-	mutex_lock(&ldev->lock);
+/*
+ * Hand a report buffer to the device, it is given back when the report is
+ * done. With the URB path this does not wait for the device, errors show
+ * up in the stats then.
+ */
+static int hidpcmeter_send(struct hidpcmeter_device *ldev, struct pcmeter_tx *tx)
+{
+	size_t len = ldev->config->report_size;
+	int ret;
 
-	/*
-	 * buffer provided to hid_hw_raw_request must not be on the stack
-	 * and must not be part of a data structure
-	 */
-	memcpy(ldev->buf, buf, ldev->config->report_size);
+	tx->queued = ktime_get_ns();
 
-	if (ldev->config->report_type == RAW_REQUEST) {
-		ret = hid_hw_raw_request(ldev->hdev, buf[0], ldev->buf,
-					 ldev->config->report_size,
-					 HID_OUTPUT_REPORT,
-					 HID_REQ_SET_REPORT);
+	if (tx->urb) {
+		usb_anchor_urb(tx->urb, &ldev->anchor);
+		ret = usb_submit_urb(tx->urb, GFP_KERNEL);
+		if (!ret)
+			return 0;
+		usb_unanchor_urb(tx->urb);
+	} else if (ldev->config->report_type == RAW_REQUEST) {
+		ret = hid_hw_raw_request(ldev->hdev, tx->buf[0], tx->buf, len,
+					 HID_OUTPUT_REPORT, HID_REQ_SET_REPORT);
+	} else if (ldev->config->report_type == OUTPUT_REPORT) {
+		ret = hid_hw_output_report(ldev->hdev, tx->buf, len);
+	} else {
+		ret = -EINVAL;
 	}
-	else if (ldev->config->report_type == OUTPUT_REPORT)
-	{
-		ret = hid_hw_output_report(ldev->hdev, ldev->buf,
-					   ldev->config->report_size);
+
+	pcmeter_tx_done(ldev, tx, ret);
+	if (ret < 0)
+		return ret;
+
+	return ret == len ? 0 : -EMSGSIZE;
+}
+
+/*
+ * Send over an URB per report buffer, straight to the interrupt OUT
+ * endpoint. Without one the buffers are sent by hid_hw_output_report().
+ */
+static int hidpcmeter_tx_init(struct hidpcmeter_device *ldev)
+{
+	struct hid_device *hdev = ldev->hdev;
+	struct usb_host_interface *alt;
+	struct usb_endpoint_descriptor *ep = NULL;
+	struct usb_interface *intf;
+	dma_addr_t dma = 0;
+	u8 *bufs;
+	int i;
+
+	init_usb_anchor(&ldev->anchor);
+	if (ldev->config->report_type == OUTPUT_REPORT && hid_is_usb(hdev)) {
+		intf = to_usb_interface(hdev->dev.parent);
+		alt = intf->cur_altsetting;
+		for (i = 0; !ep && i < alt->desc.bNumEndpoints; i++)
+			if (usb_endpoint_is_int_out(&alt->endpoint[i].desc))
+				ep = &alt->endpoint[i].desc;
+		if (ep)
+			ldev->udev = interface_to_usbdev(intf);
 	}
+
+	if (ldev->udev)
+		bufs = usb_alloc_coherent(ldev->udev, TX_SLOTS * TX_SLOT_SIZE, GFP_KERNEL, &dma);
 	else
-		ret = -EINVAL;
+		bufs = devm_kzalloc(&hdev->dev, TX_SLOTS * TX_SLOT_SIZE, GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
 
-	mutex_unlock(&ldev->lock);
+	for (i = 0; i < TX_SLOTS; i++) {
+		ldev->tx[i].ldev = ldev;
+		ldev->tx[i].buf = bufs + i * TX_SLOT_SIZE + TX_ALIGN - 1;
+		ldev->tx[i].dma = dma + i * TX_SLOT_SIZE + TX_ALIGN - 1;
+		if (!ldev->udev)
+			continue;
+		ldev->tx[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!ldev->tx[i].urb)
+			return -ENOMEM;
+		/*
+		 * The reports have the id 0 (byte 0 is always 0), so like usbhid
+		 * the URB leaves it out and sends from the aligned byte after it.
+		 */
+		usb_fill_int_urb(ldev->tx[i].urb, ldev->udev,
+				 usb_sndintpipe(ldev->udev, ep->bEndpointAddress),
+				 ldev->tx[i].buf + 1, ldev->config->report_size - 1,
+				 pcmeter_tx_complete, &ldev->tx[i], ep->bInterval);
+		ldev->tx[i].urb->transfer_dma = ldev->tx[i].dma + 1;
+		ldev->tx[i].urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
 
-	if (ret < 0)
-		return ret;
+	return 0;
+}
+
+/* after the device is off the sampler, waits for the reports on their way */
+static void hidpcmeter_tx_free(struct hidpcmeter_device *ldev)
+{
+	int i;
 
-	return ret == ldev->config->report_size ? 0 : -EMSGSIZE;
+	if (!ldev->udev)
+		return;
+
+	usb_kill_anchored_urbs(&ldev->anchor);
+	for (i = 0; i < TX_SLOTS; i++)
+		usb_free_urb(ldev->tx[i].urb);
+	if (ldev->tx[0].buf)
+		usb_free_coherent(ldev->udev, TX_SLOTS * TX_SLOT_SIZE,
+				  ldev->tx[0].buf - (TX_ALIGN - 1), ldev->tx[0].dma - (TX_ALIGN - 1));
 }
 
 static u64 my_get_idle_time(struct kernel_cpustat *kcs, int cpu)
@@ -125,40 +382,99 @@ static u64 my_get_idle_time(struct kernel_cpustat *kcs, int cpu)
 	return idle;
 }
 
-static void update_cpu_last_idle(u64 cpu_last_idle[]) {
-	int i;
-	for_each_possible_cpu(i) {
-		struct kernel_cpustat kcpustat;
-		kcpustat_cpu_fetch(&kcpustat, i);
-		cpu_last_idle[i] = my_get_idle_time(&kcpustat, i);
-	}
+static u64 my_get_iowait_time(struct kernel_cpustat *kcs, int cpu)
+{
+	u64 iowait, iowait_usecs = -1ULL;
+
+	if (cpu_online(cpu))
+		iowait_usecs = get_cpu_iowait_time_us(cpu, NULL);
+
+	if (iowait_usecs == -1ULL)
+		/* !NO_HZ or cpu offline so we can rely on cpustat.iowait */
+		iowait = kcs->cpustat[CPUTIME_IOWAIT];
+	else
+		iowait = iowait_usecs * NSEC_PER_USEC;
+
+	return iowait;
 }
 
-static u8 get_cpu_load(struct hidpcmeter_device *ldev)
+/* the only place the cpustat of a CPU is read, once per tick */
+static void pcmeter_cpu_sample(int cpu, struct pcmeter_cpu_sample *sample)
 {
-	static u64 old_timestamp = 1;
-	static u64 old_cpu_idle = 1;
-	u64 idle = 0 ;
-	u64 timestamp = 0;
-	int cpu_percent = 0;
-	int i;
+	struct kernel_cpustat kcpustat;
+	u64 *cpustat = kcpustat.cpustat;
 
-	for_each_possible_cpu(i) {
-		idle += ldev->cpu_last_idle[i];
+	kcpustat_cpu_fetch(&kcpustat, cpu);
+	sample->iowait = my_get_iowait_time(&kcpustat, cpu);
+	sample->steal = cpustat[CPUTIME_STEAL];
+	sample->irq = cpustat[CPUTIME_IRQ];
+	sample->softirq = cpustat[CPUTIME_SOFTIRQ];
+	sample->idle = my_get_idle_time(&kcpustat, cpu) + sample->iowait;
+	sample->busy = cpustat[CPUTIME_USER] + cpustat[CPUTIME_NICE] +
+		       cpustat[CPUTIME_SYSTEM] + sample->irq +
+		       sample->softirq + sample->steal;
+}
+
+/*
+ * Read every online CPU once into sampler.cpu_last, the devices derive
+ * their loads from that pass (pcmeter_device_tick).
+ * Returns the load of all CPUs since the last tick of the sampler, percent
+ * in Q8.8.
+ */
+static u16 pcmeter_sample_cpus(void)
+{
+	struct pcmeter_cpu_sample now, spent = {};
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		pcmeter_cpu_sample(cpu, &now);
+		if (cpumask_test_and_set_cpu(cpu, &sampler.cpu_sampled))
+			pcmeter_cpu_delta(&now, &sampler.cpu_last[cpu], &spent);
+		sampler.cpu_last[cpu] = now;
 	}
+	/* forget the CPUs that went offline */
+	cpumask_and(&sampler.cpu_sampled, &sampler.cpu_sampled, cpu_online_mask);
 
-	timestamp = ktime_get_ns();
-	cpu_percent = 100 - ((((idle - old_cpu_idle) / num_online_cpus()) * 100 / (timestamp - old_timestamp)));
-	if (cpu_percent < 0)
-		cpu_percent = 0;
+	return pcmeter_busy_q8(spent.idle, spent.busy + spent.idle);
+}
 
-	old_timestamp = timestamp;
-	old_cpu_idle = idle;
+/*
+ * The loads of a device since its last tick, from the CPUs read at this
+ * tick. core_load is indexed by CPU id, so a CPU that goes offline reads 0
+ * at its place instead of moving the ones behind it. A CPU that was not
+ * read at the last tick of the device has nothing to compare with and
+ * reads 0 once.
+ */
+static void pcmeter_device_tick(struct hidpcmeter_device *ldev)
+{
+	struct pcmeter_snapshot *snap = &ldev->snap;
+	struct pcmeter_cpu_sample spent = {};
+	u16 load;
+	int cpu, i;
+
+	memset(snap->core_load, 0, snap->ncores * sizeof(u16));
+	for_each_cpu(cpu, &sampler.cpu_sampled) {
+		if (cpumask_test_cpu(cpu, &ldev->cpu_sampled)) {
+			load = pcmeter_cpu_delta(&sampler.cpu_last[cpu], &ldev->cpu_last[cpu], &spent);
+			if (cpu < snap->ncores)
+				snap->core_load[cpu] = load;
+		}
+		ldev->cpu_last[cpu] = sampler.cpu_last[cpu];
+	}
+	cpumask_copy(&ldev->cpu_sampled, &sampler.cpu_sampled);
 
-	return cpu_percent;
+	snap->sys[0] = pcmeter_busy_q8(spent.idle, spent.busy + spent.idle);
+	snap->sys[1] = sampler.snap.sys[1];
+	snap->sys[2] = sampler.snap.sys[2];
+	for (i = 0; i < snap->ncores; i++)
+		snap->core_pct[i] = pcmeter_q8_to_u8(snap->core_load[i]);
+	memcpy(snap->kern, sampler.snap.kern, sizeof(snap->kern));
+	snap->kern_len = sampler.snap.kern_len;
+	pcmeter_kernel_shares(&spent, snap->kern);
 }
 
-static u8 get_mem_load(void)
+/* memory usage, percent in Q8.8 */
+static u16 get_mem_load(void)
 {
 	struct sysinfo meminfo;
 	long available;
@@ -166,43 +482,429 @@ static u8 get_mem_load(void)
 	si_meminfo(&meminfo);
 	available = si_mem_available();
 
-	if (meminfo.totalram > 0)
-		return 100 - (available * 100 / meminfo.totalram);
-	else
-		return 100;
+	return pcmeter_used_q8(max(available, 0L), meminfo.totalram);
 }
 
-static ssize_t pcmeter_pico_write(struct hidpcmeter_device *ldev)
+/* memory of a NUMA node that is not free, percent in Q8.8 */
+static u16 get_node_mem_load(int nid)
 {
-	__u8 buf[MAX_REPORT_SIZE] = {};
-	int i = 0;
-	static u64 old_timestamp = 0;
-	u64 timestamp = 1;
-	struct kernel_cpustat kcpustat;
-	u64 idle;
+	pg_data_t *pgdat = NODE_DATA(nid);
+	unsigned long managed = 0, free = 0;
+	int i;
 
+	for (i = 0; i < MAX_NR_ZONES; i++) {
+		struct zone *zone = &pgdat->node_zones[i];
 
-	buf[1] = 0; /* driver data */
-	buf[2] = get_cpu_load(ldev);
-	buf[3] = get_mem_load();
-	buf[4] = num_online_cpus();
+		managed += zone_managed_pages(zone);
+		free += zone_page_state(zone, NR_FREE_PAGES);
+	}
+	if (!managed)
+		return 0;
+	return pcmeter_used_q8(free, managed);
+}
 
-	timestamp = ktime_get_ns();
-	for_each_online_cpu(i) {
-		/* exit loop when more CPUs than buffer space */
-		if (i == MAX_REPORT_SIZE - 10)
+/*
+ * Values of the kernel report at their bytes that all devices share, the
+ * memory of every NUMA node (by node id, like the cores). Where the time
+ * of the CPUs went is up to each device.
+ * Returns the byte behind the last value.
+ */
+static int pcmeter_kernel_values(u16 *kern)
+{
+	int nid, len = PCM_KERN_NODE0;
+
+	memset(kern, 0, MAX_REPORT_SIZE * sizeof(u16));
+	kern[PCM_KERN_NODES] = min_t(unsigned int, num_online_nodes(), 255) << 8;
+	for_each_online_node(nid) {
+		if (PCM_KERN_NODE0 + nid >= MAX_REPORT_SIZE)
 			break;
-		kcpustat_cpu_fetch(&kcpustat, i);
-		idle = my_get_idle_time(&kcpustat, i);
-		buf[i+10] = 100 - ((idle - ldev->cpu_last_idle[i]) * 100 / (timestamp - old_timestamp));
+		kern[PCM_KERN_NODE0 + nid] = get_node_mem_load(nid);
+		len = PCM_KERN_NODE0 + nid + 1;
+	}
+
+	return len;
+}
+
+/* one tick of the sampler, for all devices */
+static void pcmeter_sample(struct pcmeter_snapshot *snap)
+{
+	u64 start, took;
+
+	/* all values are percent (or a count) in Q8.8 */
+	start = ktime_get_ns();
+	snap->sys[0] = pcmeter_sample_cpus();
+	took = ktime_get_ns() - start;
+	sampler.samples++;
+	hist_add(&sampler.sample, took);
+	trace_pcmeter_sample(num_online_cpus(), took, snap->sys[0]);
+	snap->sys[1] = get_mem_load();
+	snap->sys[2] = min_t(unsigned int, num_online_cpus(), 255) << 8;
+	snap->kern_len = pcmeter_kernel_values(snap->kern);
+}
+
+/*
+ * Send a v2 report. The sequence number only counts reports that went to
+ * the device, the firmware takes a gap in it for a lost report.
+ */
+static int pcmeter_send_v2_report(struct hidpcmeter_device *ldev, struct pcmeter_tx *tx)
+{
+	int ret = hidpcmeter_send(ldev, tx);
+
+	if (!ret) {
+		ldev->seq++;
+		ldev->v2_flags = 0;
+	}
+
+	return ret;
+}
+
+/* the layout from before v2, one byte per value */
+static int pcmeter_pico_send_legacy(struct hidpcmeter_device *ldev, const struct pcmeter_snapshot *snap)
+{
+	struct pcmeter_tx *tx = pcmeter_tx_get(ldev);
+	int i, ncores = min_t(int, snap->ncores, MAX_REPORT_CORES);
+
+	if (!tx)
+		return -EBUSY;
+	tx->buf[1] = PCM_REPORT_SYSTEM;
+	tx->buf[PCM_SYS_CPU] = pcmeter_q8_to_u8(snap->sys[0]);
+	tx->buf[PCM_SYS_MEM] = pcmeter_q8_to_u8(snap->sys[1]);
+	tx->buf[PCM_SYS_CPUS] = num_online_cpus();
+	for (i = 0; i < ncores; i++)
+		tx->buf[i + PCM_SYS_CORE0] = snap->core_pct[i];
+
+	return hidpcmeter_send(ldev, tx);
+}
+
+/* v2 reports, the per-core loads take more than one report if they do not fit */
+static int pcmeter_pico_send_v2(struct hidpcmeter_device *ldev, const struct pcmeter_snapshot *snap, int ncores)
+{
+	u32 now = ktime_to_ms(ktime_get());
+	struct pcmeter_tx *tx;
+	int off, sent = 0, ret;
+
+	do {
+		tx = pcmeter_tx_get(ldev);
+		if (!tx)
+			return -EBUSY;
+		off = pcm_v2_begin(tx->buf, PCM_STREAM_KERNEL, ldev->v2_flags, ldev->seq, now);
+		if (sent == 0)
+			pcm_v2_values(tx->buf, &off, PCM_REPORT_SYSTEM, PCM_SYS_CPU, 0, snap->sys, 3);
+		sent += pcm_v2_values(tx->buf, &off, PCM_REPORT_SYSTEM, PCM_SYS_CORE0 + sent, 0,
+				      snap->core_load + sent, ncores - sent);
+		ret = pcmeter_send_v2_report(ldev, tx);
+		if (ret)
+			return ret;
+	} while (sent < ncores);
+
+	return 0;
+}
+
+/*
+ * per-core loads of all cores as a frame over as many reports as needed,
+ * only the cores that changed since the last frame. The parts are only
+ * sent once all of them have a buffer, the count goes into every part.
+ */
+static int pcmeter_pico_send_cores(struct hidpcmeter_device *ldev, const struct pcmeter_snapshot *snap)
+{
+	u32 now = ktime_to_ms(ktime_get());
+	bool full = (ldev->v2_flags & PCM_V2_FLAG_RESET) || ldev->frame % PCM_CORES_KEYFRAME == 0;
+	struct pcmeter_tx *tx[PCM_CORES_PARTS_MAX];
+	int parts_at[PCM_CORES_PARTS_MAX];
+	int parts = 0, off, i, ret = 0;
+	u16 core = 0;
+
+	do {
+		tx[parts] = pcmeter_tx_get(ldev);
+		if (!tx[parts]) {
+			for (i = 0; i < parts; i++)
+				pcmeter_tx_put(ldev, tx[i]);
+			return -EBUSY;
+		}
+		/* numbered as they will be sent, the reset only goes with the first */
+		off = pcm_v2_begin(tx[parts]->buf, PCM_STREAM_KERNEL, parts ? 0 : ldev->v2_flags,
+				   ldev->seq + parts, now);
+		if (parts == 0)
+			pcm_v2_values(tx[parts]->buf, &off, PCM_REPORT_SYSTEM, PCM_SYS_CPU, 0, snap->sys, 3);
+		pcm_v2_cores(tx[parts]->buf, &off, &parts_at[parts], ldev->frame, parts, snap->ncores,
+			     full ? PCM_CORES_FLAG_FULL : 0, snap->core_pct,
+			     full ? NULL : ldev->core_sent, &core);
+		parts++;
+	} while (core < snap->ncores && parts < PCM_CORES_PARTS_MAX);
+	ldev->frame++;
+
+	for (i = 0; i < parts; i++) {
+		tx[i]->buf[parts_at[i]] = parts;
+		/* the buffers of parts that were not sent still have to go back */
+		if (ret)
+			pcmeter_tx_put(ldev, tx[i]);
+		else
+			ret = pcmeter_send_v2_report(ldev, tx[i]);
+	}
+
+	return ret;
+}
+
+/* the kernel report, only v2 firmware knows it */
+static int pcmeter_pico_send_kernel(struct hidpcmeter_device *ldev, const u16 *kern, int len)
+{
+	u32 now = ktime_to_ms(ktime_get());
+	struct pcmeter_tx *tx;
+	int off, sent = PCM_KERN_IOWAIT, ret;
+
+	do {
+		tx = pcmeter_tx_get(ldev);
+		if (!tx)
+			return -EBUSY;
+		off = pcm_v2_begin(tx->buf, PCM_STREAM_KERNEL, ldev->v2_flags, ldev->seq, now);
+		sent += pcm_v2_values(tx->buf, &off, PCM_REPORT_KERNEL, sent, 0, kern + sent, len - sent);
+		ret = pcmeter_send_v2_report(ldev, tx);
+		if (ret)
+			return ret;
+	} while (sent < len);
+
+	return 0;
+}
+
+/* the next period of a device, after the loads moved by moved percent */
+static void pcmeter_adapt(struct hidpcmeter_device *ldev, int moved)
+{
+	WRITE_ONCE(ldev->period, pcmeter_adapt_period(READ_ONCE(ldev->period), READ_ONCE(ldev->interval),
+						      READ_ONCE(keepalive), READ_ONCE(threshold),
+						      moved, READ_ONCE(adaptive)));
+}
+
+/*
+ * A tick of one device: send only if a value moved by at least threshold
+ * since the last report, or the keepalive would pass before the next tick
+ * so the firmware does not go to its screen saver.
+ */
+static ssize_t pcmeter_pico_write(struct hidpcmeter_device *ldev, const struct pcmeter_snapshot *snap)
+{
+	static const u16 no_kern[MAX_REPORT_SIZE];
+	int ncores = ldev->caps & PCM_CAP_CORES ? snap->ncores : min_t(int, snap->ncores, MAX_REPORT_CORES);
+	unsigned int since_send = jiffies_to_msecs(jiffies - ldev->last_send);
+	/* only v2 firmware knows the kernel report */
+	const u16 *kern = ldev->caps & PCM_CAP_V2 ? snap->kern : no_kern;
+	int ret;
+
+	spin_lock_irq(&ldev->lock);
+	ldev->stats.ticks++;
+	spin_unlock_irq(&ldev->lock);
+	pcmeter_adapt(ldev, pcmeter_max_delta(snap->sys, kern, snap->core_pct, ldev->sys_prev,
+					      ldev->kern_prev, ldev->core_prev, ncores));
+	memcpy(ldev->sys_prev, snap->sys, sizeof(snap->sys));
+	memcpy(ldev->kern_prev, kern, sizeof(ldev->kern_prev));
+	memcpy(ldev->core_prev, snap->core_pct, snap->ncores);
+
+	/* the first report after probing always goes out (v2_flags has the reset) */
+	if (!ldev->v2_flags &&
+	    !pcmeter_keepalive_due(since_send, READ_ONCE(ldev->period), READ_ONCE(keepalive)) &&
+	    pcmeter_max_delta(snap->sys, kern, snap->core_pct, ldev->sys_sent, ldev->kern_sent,
+			      ldev->core_sent, ncores) < READ_ONCE(threshold)) {
+		spin_lock_irq(&ldev->lock);
+		ldev->stats.skipped++;
+		spin_unlock_irq(&ldev->lock);
+		return 0;
+	}
+
+	if (ldev->caps & PCM_CAP_CORES)
+		ret = pcmeter_pico_send_cores(ldev, snap);
+	else if (ldev->caps & PCM_CAP_V2)
+		ret = pcmeter_pico_send_v2(ldev, snap, ncores);
+	else
+		ret = pcmeter_pico_send_legacy(ldev, snap);
+	if (!ret && kern != no_kern)
+		ret = pcmeter_pico_send_kernel(ldev, kern, snap->kern_len);
+	if (ret)
+		return ret;
+
+	ldev->v2_flags = 0;
+	ldev->last_send = jiffies;
+	memcpy(ldev->sys_sent, snap->sys, sizeof(snap->sys));
+	memcpy(ldev->kern_sent, kern, sizeof(ldev->kern_sent));
+	memcpy(ldev->core_sent, snap->core_pct, snap->ncores);
+
+	return 0;
+}
+
+/* queue the sampler for the device that is due next, with sampler.lock held */
+static void pcmeter_schedule(u64 now)
+{
+	struct hidpcmeter_device *ldev;
+	u64 next = U64_MAX;
+
+	list_for_each_entry(ldev, &sampler.devices, node)
+		next = min(next, ldev->due_ns);
+	if (next == U64_MAX)
+		return;
+	mod_delayed_work(pcmeter_wq, &sampler.work, next > now ? nsecs_to_jiffies(next - now) : 0);
+}
+
+static void pcmeter_sampler_work(struct work_struct *work)
+{
+	struct hidpcmeter_device *ldev;
+	u64 now;
+
+	mutex_lock(&sampler.lock);
+	if (list_empty(&sampler.devices))
+		goto out;
+
+	pcmeter_sample(&sampler.snap);
+	now = ktime_get_ns();
+	list_for_each_entry(ldev, &sampler.devices, node) {
+		/* the work may come up to a jiffy early */
+		if (ldev->due_ns > now + TICK_NSEC)
+			continue;
+		spin_lock_irq(&ldev->lock);
+		hist_add(&ldev->stats.jitter, now > ldev->due_ns ? now - ldev->due_ns : ldev->due_ns - now);
+		spin_unlock_irq(&ldev->lock);
+		pcmeter_device_tick(ldev);
+		ldev->config->write(ldev, &ldev->snap);
+		ldev->due_ns = ktime_get_ns() + (u64)ldev->period * NSEC_PER_MSEC;
+	}
+	pcmeter_schedule(ktime_get_ns());
+out:
+	mutex_unlock(&sampler.lock);
+}
+
+static ssize_t interval_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct hidpcmeter_device *ldev = hid_get_drvdata(to_hid_device(dev));
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(ldev->interval));
+}
+
+static ssize_t interval_store(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct hidpcmeter_device *ldev = hid_get_drvdata(to_hid_device(dev));
+	unsigned int ms;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &ms);
+	if (ret)
+		return ret;
+	if (ms < INTERVAL_MIN || ms > INTERVAL_MAX)
+		return -EINVAL;
+
+	mutex_lock(&sampler.lock);
+	WRITE_ONCE(ldev->interval, ms);
+	WRITE_ONCE(ldev->period, ms);
+	/* the new interval starts now, not when the old one is over */
+	ldev->due_ns = ktime_get_ns() + (u64)ms * NSEC_PER_MSEC;
+	pcmeter_schedule(ktime_get_ns());
+	mutex_unlock(&sampler.lock);
+
+	return count;
+}
+
+static DEVICE_ATTR_RW(interval);
+
+/* ask the device which report layouts it understands, old firmware does not answer */
+static void hidpcmeter_query_caps(struct hidpcmeter_device *ldev)
+{
+	int ret;
+
+	ldev->caps = PCM_CAP_LEGACY;
+	ldev->v2_flags = PCM_V2_FLAG_RESET;
+	if (!(ldev->config->caps & PCM_CAP_V2))
+		goto out;
+
+	memset(ldev->buf, 0, MAX_REPORT_SIZE);
+	ldev->buf[1] = PCM_FEATURE_CMD_CAPS;
+	ret = hid_hw_raw_request(ldev->hdev, 0, ldev->buf, MAX_REPORT_SIZE,
+				 HID_FEATURE_REPORT, HID_REQ_SET_REPORT);
+	if (ret >= 0) {
+		memset(ldev->buf, 0, MAX_REPORT_SIZE);
+		ret = hid_hw_raw_request(ldev->hdev, 0, ldev->buf, MAX_REPORT_SIZE,
+					 HID_FEATURE_REPORT, HID_REQ_GET_REPORT);
 	}
-	old_timestamp = timestamp;
+	if (ret >= PCM_CAPS_LEN && ldev->buf[1] == PCM_FEATURE_CMD_CAPS &&
+	    ldev->buf[PCM_CAPS_OFF_STATUS] == 0 &&
+	    ldev->buf[PCM_CAPS_OFF_VERSION] >= PCM_V2_VERSION)
+		ldev->caps = ldev->buf[PCM_CAPS_OFF_CAPS] & ldev->config->caps;
 
-	update_cpu_last_idle(ldev->cpu_last_idle);
+out:
+	hid_info(ldev->hdev, "using %s reports\n",
+		 ldev->caps & PCM_CAP_CORES ? "v2 with per-core frames" :
+		 ldev->caps & PCM_CAP_V2 ? "v2" : "legacy");
+}
+
+static void hist_show(struct seq_file *m, const char *name, const struct pcmeter_hist *hist)
+{
+	int i;
 
-	return hidpcmeter_send(ldev, buf);
+	seq_printf(m, "%s:\n", name);
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!hist->bucket[i])
+			continue;
+		if (i == 0)
+			seq_printf(m, "  %13s <1us %10u\n", "", hist->bucket[i]);
+		else if (i == HIST_BUCKETS - 1)
+			seq_printf(m, "  %13s >=%uus %10u\n", "", 1U << (i - 1), hist->bucket[i]);
+		else
+			seq_printf(m, "  %6u-%6uus %10u\n", 1U << (i - 1), (1U << i) - 1, hist->bucket[i]);
+	}
 }
 
+static int pcmeter_stats_show(struct seq_file *m, void *unused)
+{
+	struct hidpcmeter_device *ldev = m->private;
+	struct pcmeter_stats stats;
+
+	/* a copy, the sampler and URB completions update them meanwhile */
+	spin_lock_irq(&ldev->lock);
+	stats = ldev->stats;
+	spin_unlock_irq(&ldev->lock);
+
+	seq_printf(m, "ticks: %llu\n", stats.ticks);
+	seq_printf(m, "skipped: %llu\n", stats.skipped);
+	seq_printf(m, "reports sent: %llu\n", stats.sent);
+	seq_printf(m, "send errors: %llu (last %d)\n", stats.errors, stats.last_error);
+	seq_printf(m, "short writes: %llu\n", stats.short_writes);
+	seq_printf(m, "busy: %llu\n", stats.busy);
+	seq_printf(m, "interval: %u ms, period: %u ms\n",
+		   READ_ONCE(ldev->interval), READ_ONCE(ldev->period));
+	seq_printf(m, "output: %s\n", ldev->udev ? "urb" : "hid");
+	hist_show(m, "send", &stats.send);
+	hist_show(m, "tick jitter", &stats.jitter);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pcmeter_stats);
+
+static int pcmeter_sampler_show(struct seq_file *m, void *unused)
+{
+	struct hidpcmeter_device *ldev;
+	int devices = 0;
+
+	mutex_lock(&sampler.lock);
+	list_for_each_entry(ldev, &sampler.devices, node)
+		devices++;
+	seq_printf(m, "devices: %d\n", devices);
+	seq_printf(m, "samples: %llu\n", sampler.samples);
+	hist_show(m, "sample time", &sampler.sample);
+	mutex_unlock(&sampler.lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pcmeter_sampler);
+
+static int pcmeter_last_report_show(struct seq_file *m, void *unused)
+{
+	struct hidpcmeter_device *ldev = m->private;
+	u8 report[MAX_REPORT_SIZE];
+
+	spin_lock_irq(&ldev->lock);
+	memcpy(report, ldev->last_report, MAX_REPORT_SIZE);
+	spin_unlock_irq(&ldev->lock);
+	seq_hex_dump(m, "", DUMP_PREFIX_OFFSET, 16, 1, report, MAX_REPORT_SIZE, false);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pcmeter_last_report);
+
 static const struct hidpcmeter_config hidpcmeter_configs[] = {
 {
     .type = PC_METER_PICO,
@@ -210,6 +912,8 @@ static const struct hidpcmeter_config hidpcmeter_configs[] = {
 	.short_name = "pcmeter-pico",
 	.report_size = 64,
 	.report_type = OUTPUT_REPORT,
+	.interval = 0,
+	.caps = PCM_CAP_LEGACY | PCM_CAP_V2 | PCM_CAP_CORES,
 	.write = pcmeter_pico_write,
 }
 };
@@ -224,9 +928,7 @@ static int hidpcmeter_probe(struct hid_device *hdev, const struct hid_device_id
 		return -ENOMEM;
 	hid_set_drvdata(hdev, ldev);
 	ldev->hdev = hdev;
-	mutex_init(&ldev->lock);
-	ldev->connected = true;
-	spin_lock_init(&ldev->slock);
+	spin_lock_init(&ldev->lock);
 
 	ldev->buf = devm_kmalloc(&hdev->dev, MAX_REPORT_SIZE, GFP_KERNEL);
 	if (!ldev->buf)
@@ -254,20 +956,49 @@ static int hidpcmeter_probe(struct hid_device *hdev, const struct hid_device_id
 		return ret;
 	}
 
-	ldev->cpu_last_idle = devm_kzalloc(&hdev->dev, num_possible_cpus() * sizeof(u64), GFP_KERNEL);
-	if (!ldev->cpu_last_idle) {
+	ldev->core_sent = devm_kzalloc(&hdev->dev, sampler.snap.ncores, GFP_KERNEL);
+	ldev->core_prev = devm_kzalloc(&hdev->dev, sampler.snap.ncores, GFP_KERNEL);
+	ldev->cpu_last = devm_kcalloc(&hdev->dev, nr_cpu_ids, sizeof(*ldev->cpu_last), GFP_KERNEL);
+	ldev->snap.ncores = sampler.snap.ncores;
+	ldev->snap.core_load = devm_kcalloc(&hdev->dev, ldev->snap.ncores, sizeof(u16), GFP_KERNEL);
+	ldev->snap.core_pct = devm_kzalloc(&hdev->dev, ldev->snap.ncores, GFP_KERNEL);
+	if (!ldev->core_sent || !ldev->core_prev || !ldev->cpu_last ||
+	    !ldev->snap.core_load || !ldev->snap.core_pct) {
 		ret = -ENOMEM;
 		goto error_hw_stop;
 	}
 
-	INIT_WORK(&ldev->work_arg, pcmeter_work_function);
-	ldev->interval = interval;
-	schedule_work(&ldev->work_arg);
+	ret = hidpcmeter_tx_init(ldev);
+	if (ret)
+		goto error_tx_free;
+
+	hidpcmeter_query_caps(ldev);
+
+	ldev->interval = clamp_t(int, ldev->config->interval ?: interval, INTERVAL_MIN, INTERVAL_MAX);
+	ldev->period = ldev->interval;
+	ret = device_create_file(&hdev->dev, &dev_attr_interval);
+	if (ret)
+		goto error_tx_free;
+
+	ldev->debugfs = debugfs_create_dir(dev_name(&hdev->dev), pcmeter_debugfs);
+	debugfs_create_file("stats", 0444, ldev->debugfs, ldev, &pcmeter_stats_fops);
+	debugfs_create_file("last_report", 0444, ldev->debugfs, ldev, &pcmeter_last_report_fops);
+
+	/* the first tick is right away, its loads go back to the last tick of the sampler */
+	mutex_lock(&sampler.lock);
+	memcpy(ldev->cpu_last, sampler.cpu_last, nr_cpu_ids * sizeof(*ldev->cpu_last));
+	cpumask_copy(&ldev->cpu_sampled, &sampler.cpu_sampled);
+	ldev->due_ns = ktime_get_ns();
+	list_add_tail(&ldev->node, &sampler.devices);
+	pcmeter_schedule(ldev->due_ns);
+	mutex_unlock(&sampler.lock);
 
 	hid_info(hdev, "%s initialized\n", ldev->config->name);
 
 	return 0;
 
+error_tx_free:
+	hidpcmeter_tx_free(ldev);
 error_hw_stop:
 	hid_hw_stop(hdev);
 	return ret;
@@ -276,14 +1007,19 @@ error_hw_stop:
 static void hidpcmeter_remove(struct hid_device *hdev)
 {
 	struct hidpcmeter_device *ldev = hid_get_drvdata(hdev);
-	unsigned long flags;
 
-	spin_lock_irqsave(&ldev->slock, flags);
-	ldev->connected = false;
-	spin_unlock_irqrestore(&ldev->slock, flags);
+	device_remove_file(&hdev->dev, &dev_attr_interval);
 
-	cancel_work_sync(&ldev->work_arg);
-	flush_work(&ldev->work_arg);
+	/* once off the list the sampler does not tick the device anymore */
+	mutex_lock(&sampler.lock);
+	list_del(&ldev->node);
+	/* without devices nobody samples, the next one starts afresh */
+	if (list_empty(&sampler.devices))
+		cpumask_clear(&sampler.cpu_sampled);
+	mutex_unlock(&sampler.lock);
+
+	hidpcmeter_tx_free(ldev);
+	debugfs_remove_recursive(ldev->debugfs);
 	hid_hw_stop(hdev);
 }
 
@@ -301,7 +1037,47 @@ static struct hid_driver hidpcmeter_driver = {
 	.remove = hidpcmeter_remove,
 };
 
-module_hid_driver(hidpcmeter_driver);
+static int __init hidpcmeter_init(void)
+{
+	int ret;
+
+	/* per-core loads, the firmware keeps up to PCM_CORES_MAX cores */
+	sampler.snap.ncores = min_t(unsigned int, nr_cpu_ids, PCM_CORES_MAX);
+	sampler.cpu_last = kcalloc(nr_cpu_ids, sizeof(*sampler.cpu_last), GFP_KERNEL);
+	INIT_DELAYED_WORK(&sampler.work, pcmeter_sampler_work);
+	pcmeter_wq = alloc_workqueue("hid_pcmeter", WQ_UNBOUND | WQ_FREEZABLE, 0);
+	if (!sampler.cpu_last || !pcmeter_wq) {
+		ret = -ENOMEM;
+		goto error_free;
+	}
+	pcmeter_debugfs = debugfs_create_dir("hid_pcmeter", NULL);
+	debugfs_create_file("sampler", 0444, pcmeter_debugfs, NULL, &pcmeter_sampler_fops);
+
+	ret = hid_register_driver(&hidpcmeter_driver);
+	if (ret)
+		goto error_debugfs;
+	return 0;
+
+error_debugfs:
+	debugfs_remove_recursive(pcmeter_debugfs);
+error_free:
+	if (pcmeter_wq)
+		destroy_workqueue(pcmeter_wq);
+	kfree(sampler.cpu_last);
+	return ret;
+}
+
+static void __exit hidpcmeter_exit(void)
+{
+	hid_unregister_driver(&hidpcmeter_driver);
+	cancel_delayed_work_sync(&sampler.work);
+	debugfs_remove_recursive(pcmeter_debugfs);
+	destroy_workqueue(pcmeter_wq);
+	kfree(sampler.cpu_last);
+}
+
+module_init(hidpcmeter_init);
+module_exit(hidpcmeter_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Pascal Jaeger <pascal.jaeger@leimstift.de");
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * The arithmetic of the pcmeter driver, see pcmeter_core.h
+ */
+
+#include "pcmeter_core.h"
+#include "pcmeter_protocol.h"
+
+#ifdef __KERNEL__
+#include <linux/limits.h>
+#include <linux/math64.h>
+#ifndef UINT64_MAX
+#define UINT64_MAX U64_MAX
+#endif
+#endif
+
+static uint64_t min_u64(uint64_t a, uint64_t b)
+{
+	return a < b ? a : b;
+}
+
+/* part of whole in percent Q8.8, part must not be bigger than whole */
+static uint16_t q8_of(uint64_t part, uint64_t whole)
+{
+	/* part * 25600 has to fit, which it does for up to 8 days in ns */
+	while (part > UINT64_MAX / 25600) {
+		part >>= 1;
+		whole >>= 1;
+	}
+#ifdef __KERNEL__
+	return div64_u64(part * 25600, whole);
+#else
+	return part * 25600 / whole;
+#endif
+}
+
+static uint64_t since(uint64_t now, uint64_t last)
+{
+	/* the NO_HZ idle time of a CPU can step back a little */
+	return now > last ? now - last : 0;
+}
+
+uint16_t pcmeter_busy_q8(uint64_t idle, uint64_t elapsed)
+{
+	if (!elapsed || idle >= elapsed)
+		return 0;
+	return 25600 - q8_of(idle, elapsed);
+}
+
+uint16_t pcmeter_share_q8(uint64_t part, uint64_t elapsed)
+{
+	if (!elapsed)
+		return 0;
+	return q8_of(min_u64(part, elapsed), elapsed);
+}
+
+uint16_t pcmeter_used_q8(uint64_t available, uint64_t total)
+{
+	if (!total)
+		return 25600;
+	return 25600 - q8_of(min_u64(available, total), total);
+}
+
+uint16_t pcmeter_cpu_delta(const struct pcmeter_cpu_sample *now,
+			   const struct pcmeter_cpu_sample *last,
+			   struct pcmeter_cpu_sample *spent)
+{
+	uint64_t busy = since(now->busy, last->busy);
+	uint64_t idle = since(now->idle, last->idle);
+
+	spent->busy += busy;
+	spent->idle += idle;
+	spent->iowait += since(now->iowait, last->iowait);
+	spent->steal += since(now->steal, last->steal);
+	spent->irq += since(now->irq, last->irq);
+	spent->softirq += since(now->softirq, last->softirq);
+
+	return pcmeter_busy_q8(idle, busy + idle);
+}
+
+void pcmeter_kernel_shares(const struct pcmeter_cpu_sample *spent, uint16_t *kern)
+{
+	uint64_t elapsed = spent->busy + spent->idle;
+
+	kern[PCM_KERN_IOWAIT] = pcmeter_share_q8(spent->iowait, elapsed);
+	kern[PCM_KERN_STEAL] = pcmeter_share_q8(spent->steal, elapsed);
+	kern[PCM_KERN_IRQ] = pcmeter_share_q8(spent->irq, elapsed);
+	kern[PCM_KERN_SOFTIRQ] = pcmeter_share_q8(spent->softirq, elapsed);
+}
+
+static int delta_u8(int a, int b)
+{
+	return a > b ? a - b : b - a;
+}
+
+int pcmeter_max_delta(const uint16_t *sys, const uint16_t *kern, const uint8_t *cores,
+		      const uint16_t *sys_ref, const uint16_t *kern_ref, const uint8_t *cores_ref,
+		      int ncores)
+{
+	int i, d, delta = 0;
+
+	for (i = 0; i < 3; i++) {
+		d = delta_u8(pcmeter_q8_to_u8(sys[i]), pcmeter_q8_to_u8(sys_ref[i]));
+		delta = d > delta ? d : delta;
+	}
+	for (i = 0; i < PCM_REPORT_SIZE; i++) {
+		d = delta_u8(pcmeter_q8_to_u8(kern[i]), pcmeter_q8_to_u8(kern_ref[i]));
+		delta = d > delta ? d : delta;
+	}
+	for (i = 0; i < ncores; i++) {
+		d = delta_u8(cores[i], cores_ref[i]);
+		delta = d > delta ? d : delta;
+	}
+
+	return delta;
+}
+
+unsigned int pcmeter_adapt_period(unsigned int period, unsigned int interval,
+				  unsigned int keepalive, int threshold, int moved,
+				  bool adaptive)
+{
+	unsigned int fast = interval / 4 > INTERVAL_MIN ? interval / 4 : INTERVAL_MIN;
+	unsigned int slow = interval * 4 < keepalive ? interval * 4 : keepalive;
+	int thr = threshold > 1 ? threshold : 1;
+
+	if (slow < interval)
+		slow = interval;
+
+	if (!adaptive)
+		period = interval;
+	else if (moved >= 4 * thr)
+		period = period / 2;
+	else if (moved < thr)
+		period = period + period / 4;
+	else
+		period = (period + interval) / 2;
+
+	if (period < fast)
+		return fast;
+	if (period > slow)
+		return slow;
+	return period;
+}
+
+bool pcmeter_keepalive_due(unsigned int since_send, unsigned int period,
+			   unsigned int keepalive)
+{
+	return (uint64_t)since_send + period >= keepalive;
+}
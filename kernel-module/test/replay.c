@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replays recorded /proc/stat snapshots through the arithmetic of the
+ * driver (libpcmeter-core.a) and checks that every load and share stays
+ * within 0..100%, also when a CPU is read twice with no time in between.
+ * Then simulates the ticks of a device with steady loads and checks that
+ * no gap between two reports is longer than the keepalive.
+ *
+ *   replay [-f rounds] trace...
+ *
+ * A trace is the output of grep '^cpu' /proc/stat, read again and again.
+ * Every "cpu " line starts a snapshot, lines that are not cpu lines are
+ * skipped. -f also feeds random counters that step back, stand still and
+ * jump by days.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcmeter_core.h"
+#include "pcmeter_protocol.h"
+
+#define MAX_CPUS	512
+#define MAX_SNAPSHOTS	4096
+/* ns per USER_HZ tick of /proc/stat */
+#define TICK_NS		10000000ULL
+
+struct snapshot {
+	struct pcmeter_cpu_sample all;
+	struct pcmeter_cpu_sample cpu[MAX_CPUS];
+	unsigned char online[MAX_CPUS];
+};
+
+static int failures;
+
+#define check(cond, ...) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, __VA_ARGS__);				\
+		fputc('\n', stderr);					\
+		failures++;						\
+	}								\
+} while (0)
+
+/* "user nice system idle iowait irq softirq steal ..." the way the driver adds them up */
+static int parse_cpu(const char *fields, struct pcmeter_cpu_sample *s)
+{
+	unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+
+	if (sscanf(fields, "%llu %llu %llu %llu %llu %llu %llu %llu",
+		   &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) != 8)
+		return -1;
+	s->iowait = iowait * TICK_NS;
+	s->steal = steal * TICK_NS;
+	s->irq = irq * TICK_NS;
+	s->softirq = softirq * TICK_NS;
+	s->idle = (idle + iowait) * TICK_NS;
+	s->busy = (user + nice + system + irq + softirq + steal) * TICK_NS;
+	return 0;
+}
+
+static int load_trace(const char *path, struct snapshot *snaps)
+{
+	char line[512];
+	int n = -1, cpu, off;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "cpu ", 4)) {
+			if (++n == MAX_SNAPSHOTS)
+				break;
+			memset(&snaps[n], 0, sizeof(snaps[n]));
+			if (parse_cpu(line + 4, &snaps[n].all))
+				goto bad;
+		} else if (sscanf(line, "cpu%d %n", &cpu, &off) == 1) {
+			if (n < 0 || cpu < 0 || cpu >= MAX_CPUS || parse_cpu(line + off, &snaps[n].cpu[cpu]))
+				goto bad;
+			snaps[n].online[cpu] = 1;
+		}
+	}
+	fclose(f);
+	return n + 1;
+bad:
+	fprintf(stderr, "%s: bad line: %s", path, line);
+	fclose(f);
+	return -1;
+}
+
+/* the loads of the CPUs from last to now, like a tick of a device does */
+static void check_interval(const char *name, int i, const struct snapshot *now,
+			   const struct snapshot *last)
+{
+	struct pcmeter_cpu_sample spent = {};
+	uint16_t kern[PCM_REPORT_SIZE] = {};
+	uint16_t load, busy;
+	unsigned int sum = 0;
+	int cpu, k;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (!now->online[cpu] || !last->online[cpu])
+			continue;
+		load = pcmeter_cpu_delta(&now->cpu[cpu], &last->cpu[cpu], &spent);
+		check(load <= 25600, "%s %d: cpu%d load %u", name, i, cpu, load);
+	}
+	busy = pcmeter_busy_q8(spent.idle, spent.busy + spent.idle);
+	check(busy <= 25600, "%s %d: load %u", name, i, busy);
+
+	pcmeter_kernel_shares(&spent, kern);
+	for (k = PCM_KERN_IOWAIT; k <= PCM_KERN_SOFTIRQ; k++) {
+		check(kern[k] <= 25600, "%s %d: share at %d is %u", name, i, k, kern[k]);
+		sum += kern[k];
+	}
+	/* iowait is idle time, steal and interrupts are busy time, none overlap */
+	check(sum <= 25600, "%s %d: shares add up to %u", name, i, sum);
+	check(busy + kern[PCM_KERN_IOWAIT] <= 25600, "%s %d: load %u and iowait %u",
+	      name, i, busy, kern[PCM_KERN_IOWAIT]);
+
+	if (now == last)
+		check(busy == 0 && sum == 0, "%s %d: %u and %u without any time", name, i, busy, sum);
+}
+
+static int replay(const char *path)
+{
+	static struct snapshot snaps[MAX_SNAPSHOTS];
+	int n = load_trace(path, snaps);
+	int i, before = failures;
+
+	if (n < 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		/* a tick with no time since the last one, e.g. a device that just came */
+		check_interval(path, i, &snaps[i], &snaps[i]);
+		if (i)
+			check_interval(path, i, &snaps[i], &snaps[i - 1]);
+	}
+	printf("%s: %d snapshots %s\n", path, n, failures == before ? "ok" : "FAILED");
+	return 0;
+}
+
+static uint64_t rand64(void)
+{
+	return (uint64_t)random() << 33 ^ (uint64_t)random() << 2 ^ (uint64_t)random();
+}
+
+/* a counter that mostly grows, sometimes stands still, steps back or jumps by days */
+static uint64_t step(uint64_t v)
+{
+	switch (random() % 8) {
+	case 0:
+		return v;
+	case 1:
+		return v - (v ? rand64() % (v < 100000 ? v : 100000) : 0);
+	case 2:
+		return v + rand64() % (30 * 86400 * 1000000000ULL);
+	default:
+		return v + rand64() % 100000000;
+	}
+}
+
+/* the load the driver should come up with, without rounding and overflow */
+static long double exact_load(const struct pcmeter_cpu_sample *now,
+			      const struct pcmeter_cpu_sample *last)
+{
+	long double busy = now->busy > last->busy ? now->busy - last->busy : 0;
+	long double idle = now->idle > last->idle ? now->idle - last->idle : 0;
+
+	return busy + idle > 0 && busy > 0 ? busy * 25600 / (busy + idle) : 0;
+}
+
+static void fuzz(int rounds)
+{
+	struct pcmeter_cpu_sample last, now = {}, spent;
+	uint16_t kern[PCM_REPORT_SIZE];
+	unsigned int sum;
+	long double exact;
+	uint16_t load;
+	int i, k, before = failures;
+
+	srandom(1);
+	for (i = 0; i < rounds; i++) {
+		last = now;
+		now.iowait = step(last.iowait);
+		now.steal = step(last.steal);
+		now.irq = step(last.irq);
+		now.softirq = step(last.softirq);
+		now.idle = step(last.idle);
+		now.busy = step(last.busy);
+
+		memset(&spent, 0, sizeof(spent));
+		load = pcmeter_cpu_delta(&now, &last, &spent);
+		check(load <= 25600, "fuzz %d: load %u", i, load);
+		exact = exact_load(&now, &last);
+		check(load >= exact - 2 && load <= exact + 2, "fuzz %d: load %u instead of %.0Lf",
+		      i, load, exact);
+		pcmeter_kernel_shares(&spent, kern);
+		for (k = PCM_KERN_IOWAIT, sum = 0; k <= PCM_KERN_SOFTIRQ; k++) {
+			check(kern[k] <= 25600, "fuzz %d: share at %d is %u", i, k, kern[k]);
+			sum += kern[k];
+		}
+		/* random counters overlap, only each of them has to stay in range */
+		check(sum <= 4 * 25600, "fuzz %d: shares add up to %u", i, sum);
+		check(pcmeter_used_q8(rand64() % 3, rand64() % 3) <= 25600, "fuzz %d: used", i);
+		check(pcmeter_share_q8(rand64(), rand64() % 3) <= 25600, "fuzz %d: share", i);
+	}
+	printf("fuzz: %d rounds %s\n", rounds, failures == before ? "ok" : "FAILED");
+}
+
+/*
+ * A device with steady loads, ticking at jiffies that may come up to a
+ * jiffy early or late, sends only for the keepalive. No gap between two
+ * reports may be longer than the keepalive (or the interval, if that is
+ * longer) plus the jitter.
+ */
+static void keepalive(unsigned int interval, unsigned int keepalive, unsigned int jiffy)
+{
+	unsigned int period = interval, since, gap, longest = 0;
+	unsigned int limit = (interval > keepalive ? interval : keepalive) + 2 * jiffy;
+	unsigned long t = 0, last_send = 0;
+	int i, before = failures;
+
+	for (i = 0; i < 10000; i++) {
+		t += period + jiffy - random() % (2 * jiffy + 1);
+		/* since_send in whole jiffies, like jiffies_to_msecs(jiffies - last_send) */
+		since = (t / jiffy - last_send / jiffy) * jiffy;
+		period = pcmeter_adapt_period(period, interval, keepalive, 1, 0, true);
+		if (!pcmeter_keepalive_due(since, period, keepalive))
+			continue;
+		gap = t - last_send;
+		longest = gap > longest ? gap : longest;
+		check(!i || gap <= limit, "keepalive %u interval %u jiffy %u: %u ms without a report",
+		      keepalive, interval, jiffy, gap);
+		last_send = t;
+	}
+	printf("keepalive %u interval %u jiffy %u: longest gap %u ms %s\n", keepalive, interval,
+	       jiffy, longest, failures == before ? "ok" : "FAILED");
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int intervals[] = { INTERVAL_MIN, 100, 250, 333, 500, 1000, 2000 };
+	int i, k, rounds = 0, opt;
+
+	while ((opt = getopt(argc, argv, "f:")) != -1) {
+		switch (opt) {
+		case 'f':
+			rounds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f rounds] trace...\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = optind; i < argc; i++)
+		if (replay(argv[i]))
+			return 2;
+	if (rounds)
+		fuzz(rounds);
+
+	/* HZ 250 and 100 */
+	srandom(1);
+	for (i = 0; i < (int)(sizeof(intervals) / sizeof(intervals[0])); i++)
+		for (k = 0; k < 2; k++) {
+			keepalive(intervals[i], 1500, k ? 10 : 4);
+			keepalive(intervals[i], 1000, k ? 10 : 4);
+		}
+
+	if (failures)
+		fprintf(stderr, "%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
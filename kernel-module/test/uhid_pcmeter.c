@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * A pcmeter-pico made up through /dev/uhid: registers 2e8a:c011 with the
+ * report descriptor of the firmware, answers the capability query and
+ * checks every report the driver sends it.
+ *
+ *   uhid_pcmeter [-l | -2] [-t seconds] [-k keepalive_ms]
+ *
+ * -l answers like legacy firmware (no capabilities), -2 like v2 firmware
+ * without per-core frames, the default is v2 with per-core frames.
+ * Needs the uhid and hid_pcmeter modules loaded and access to /dev/uhid.
+ * A uhid device is not on USB, so the reports go through
+ * hid_hw_output_report(); the URB path needs a real Pico.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+
+#include "pcmeter_protocol.h"
+
+#define USB_VID		0x2e8a
+#define USB_PID		0xc011
+/* a report may come that much later than the keepalive */
+#define LATE_MS		500
+
+/* TUD_HID_REPORT_DESC_GENERIC_INOUT_FEATURE(64) of pico-firmware/src/usb_descriptors.c */
+static const uint8_t rdesc[] = {
+	0x06, 0x00, 0xff,	/* Usage Page (Vendor 0xff00) */
+	0x09, 0x01,		/* Usage (1) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x09, 0x02,		/*   Usage (2) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*   Logical Maximum (255) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, 0x40,		/*   Report Count (64) */
+	0x81, 0x02,		/*   Input (Data, Variable, Absolute) */
+	0x09, 0x03,		/*   Usage (3) */
+	0x15, 0x00,
+	0x26, 0xff, 0x00,
+	0x75, 0x08,
+	0x95, 0x40,
+	0x91, 0x02,		/*   Output (Data, Variable, Absolute) */
+	0x09, 0x04,		/*   Usage (4) */
+	0x15, 0x00,
+	0x26, 0xff, 0x00,
+	0x75, 0x08,
+	0x95, 0x40,
+	0xb1, 0x02,		/*   Feature (Data, Variable, Absolute) */
+	0xc0,			/* End Collection */
+};
+
+static uint8_t caps = PCM_CAP_LEGACY | PCM_CAP_V2 | PCM_CAP_CORES;
+static bool cmd_caps;		/* the host asked for the capabilities */
+static bool seq_known;
+static uint16_t seq;
+static unsigned long reports, v2_reports, failures;
+
+#define fail(...) do {							\
+	fprintf(stderr, __VA_ARGS__);					\
+	fputc('\n', stderr);						\
+	failures++;							\
+} while (0)
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+	ssize_t ret = write(fd, ev, sizeof(*ev));
+
+	if (ret < 0) {
+		perror("write /dev/uhid");
+		return -errno;
+	}
+	return ret == sizeof(*ev) ? 0 : -EFAULT;
+}
+
+static int create(int fd)
+{
+	struct uhid_event ev = { .type = UHID_CREATE2 };
+
+	strcpy((char *)ev.u.create2.name, "PCMeter-Pico (uhid)");
+	memcpy(ev.u.create2.rd_data, rdesc, sizeof(rdesc));
+	ev.u.create2.rd_size = sizeof(rdesc);
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = USB_VID;
+	ev.u.create2.product = USB_PID;
+	return uhid_write(fd, &ev);
+}
+
+/* the feature report of the firmware: [1] command, see feature.h */
+static int set_report(int fd, const struct uhid_set_report_req *req)
+{
+	struct uhid_event ev = { .type = UHID_SET_REPORT_REPLY };
+
+	ev.u.set_report_reply.id = req->id;
+	if (req->rtype != UHID_FEATURE_REPORT || req->size < 2) {
+		ev.u.set_report_reply.err = EIO;
+	} else {
+		cmd_caps = req->data[1] == PCM_FEATURE_CMD_CAPS;
+		/* legacy firmware stalls on features it does not know */
+		ev.u.set_report_reply.err = cmd_caps && !(caps & PCM_CAP_V2) ? EIO : 0;
+	}
+	return uhid_write(fd, &ev);
+}
+
+static int get_report(int fd, const struct uhid_get_report_req *req)
+{
+	struct uhid_event ev = { .type = UHID_GET_REPORT_REPLY };
+	uint8_t *buf = ev.u.get_report_reply.data;
+
+	ev.u.get_report_reply.id = req->id;
+	if (req->rtype != UHID_FEATURE_REPORT || !cmd_caps || !(caps & PCM_CAP_V2)) {
+		ev.u.get_report_reply.err = EIO;
+		return uhid_write(fd, &ev);
+	}
+	buf[1] = PCM_FEATURE_CMD_CAPS;
+	buf[PCM_CAPS_OFF_STATUS] = 0;
+	buf[PCM_CAPS_OFF_CAPS] = caps;
+	buf[PCM_CAPS_OFF_VERSION] = PCM_V2_VERSION;
+	buf[PCM_CAPS_OFF_SIZE] = PCM_REPORT_SIZE;
+	ev.u.get_report_reply.size = PCM_REPORT_SIZE;
+	return uhid_write(fd, &ev);
+}
+
+/* bytes of the legacy system report and values of v2 reports that are percent */
+static bool is_percent(uint8_t report, int byte)
+{
+	if (report == PCM_REPORT_SYSTEM)
+		return byte == PCM_SYS_CPU || byte == PCM_SYS_MEM || byte >= PCM_SYS_CORE0;
+	if (report == PCM_REPORT_KERNEL)
+		return (byte >= PCM_KERN_IOWAIT && byte <= PCM_KERN_SOFTIRQ) || byte >= PCM_KERN_NODE0;
+	return false;
+}
+
+static void check_legacy(const uint8_t *buf)
+{
+	int i;
+
+	if (buf[1] != PCM_REPORT_SYSTEM) {
+		fail("legacy report %#x", buf[1]);
+		return;
+	}
+	if (!buf[PCM_SYS_CPUS])
+		fail("legacy report without CPUs");
+	for (i = 2; i < PCM_REPORT_SIZE; i++)
+		if (is_percent(buf[1], i) && buf[i] > 100)
+			fail("legacy report: %u%% at byte %d", buf[i], i);
+}
+
+static void check_values(const uint8_t *v, int len)
+{
+	int i, n = (len - PCM_TLV_VALUES_HDR) / 2;
+	uint16_t value;
+
+	if (len < PCM_TLV_VALUES_HDR || (len - PCM_TLV_VALUES_HDR) % 2) {
+		fail("values TLV of %d bytes", len);
+		return;
+	}
+	if (v[0] != PCM_REPORT_SYSTEM && v[0] != PCM_REPORT_KERNEL)
+		fail("values of report %#x", v[0]);
+	for (i = 0; i < n; i++) {
+		value = pcm_get_le16(&v[PCM_TLV_VALUES_HDR + i * 2]);
+		if (is_percent(v[0], v[1] + i) && value > 100 << 8)
+			fail("report %#x: %u.%02u%% at byte %d", v[0], value >> 8,
+			     (value & 0xff) * 100 / 256, v[1] + i);
+	}
+}
+
+static void check_cores(const uint8_t *v, int len)
+{
+	uint16_t ncores = pcm_get_le16(&v[4]), first;
+	int off = PCM_CORES_HDR, i, n;
+
+	if (len < PCM_CORES_HDR || v[2] >= v[3] || !ncores || ncores > PCM_CORES_MAX) {
+		fail("cores TLV: part %u of %u, %u cores, %d bytes", v[2], v[3], ncores, len);
+		return;
+	}
+	while (off + PCM_CORES_RUN_HDR <= len) {
+		first = pcm_get_le16(&v[off]);
+		n = v[off + 2];
+		if (!n || first + n > ncores || off + PCM_CORES_RUN_HDR + n > len) {
+			fail("cores run of %d from %u of %u cores", n, first, ncores);
+			return;
+		}
+		for (i = 0; i < n; i++)
+			if (v[off + PCM_CORES_RUN_HDR + i] > 100)
+				fail("core %d at %u%%", first + i, v[off + PCM_CORES_RUN_HDR + i]);
+		off += PCM_CORES_RUN_HDR + n;
+	}
+	if (off != len)
+		fail("cores TLV with %d bytes left", len - off);
+}
+
+static void check_v2(const uint8_t *buf)
+{
+	uint16_t s = pcm_get_le16(&buf[PCM_V2_OFF_SEQ]);
+	int off = PCM_V2_OFF_TLV, len;
+
+	v2_reports++;
+	if (!(caps & PCM_CAP_V2))
+		fail("v2 report to legacy firmware");
+	if (buf[PCM_V2_OFF_VERSION] != PCM_V2_VERSION || buf[PCM_V2_OFF_STREAM] != PCM_STREAM_KERNEL)
+		fail("v2 version %u stream %u", buf[PCM_V2_OFF_VERSION], buf[PCM_V2_OFF_STREAM]);
+
+	if (!seq_known && !(buf[PCM_V2_OFF_FLAGS] & PCM_V2_FLAG_RESET))
+		fail("first v2 report without PCM_V2_FLAG_RESET");
+	else if (seq_known && buf[PCM_V2_OFF_FLAGS] & PCM_V2_FLAG_RESET)
+		fail("PCM_V2_FLAG_RESET at seq %u", s);
+	else if (seq_known && s != (uint16_t)(seq + 1))
+		fail("seq %u after %u", s, seq);
+	seq = s;
+	seq_known = true;
+
+	while (off + PCM_TLV_HDR <= PCM_REPORT_SIZE && buf[off] != PCM_TLV_END) {
+		len = buf[off + 1];
+		if (off + PCM_TLV_HDR + len > PCM_REPORT_SIZE) {
+			fail("TLV %u of %d bytes at %d", buf[off], len, off);
+			return;
+		}
+		if (buf[off] == PCM_TLV_VALUES)
+			check_values(&buf[off + PCM_TLV_HDR], len);
+		else if (buf[off] == PCM_TLV_CORES && !(caps & PCM_CAP_CORES))
+			fail("cores TLV to firmware without PCM_CAP_CORES");
+		else if (buf[off] == PCM_TLV_CORES)
+			check_cores(&buf[off + PCM_TLV_HDR], len);
+		off += PCM_TLV_HDR + len;
+	}
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd = { .events = POLLIN };
+	struct uhid_event ev;
+	long start, last = 0, gap, longest = 0, seconds = 10, keepalive = 1500;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "l2t:k:")) != -1) {
+		switch (opt) {
+		case 'l':
+			caps = PCM_CAP_LEGACY;
+			break;
+		case '2':
+			caps = PCM_CAP_LEGACY | PCM_CAP_V2;
+			break;
+		case 't':
+			seconds = atol(optarg);
+			break;
+		case 'k':
+			keepalive = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l | -2] [-t seconds] [-k keepalive_ms]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	pfd.fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (pfd.fd < 0) {
+		perror("open /dev/uhid");
+		return 2;
+	}
+	if (create(pfd.fd))
+		return 2;
+
+	start = now_ms();
+	while (now_ms() - start < seconds * 1000) {
+		ret = poll(&pfd, 1, 100);
+		if (ret < 0 && errno != EINTR) {
+			perror("poll");
+			return 2;
+		}
+		if (ret <= 0)
+			continue;
+		if (read(pfd.fd, &ev, sizeof(ev)) < 0) {
+			perror("read /dev/uhid");
+			return 2;
+		}
+
+		switch (ev.type) {
+		case UHID_SET_REPORT:
+			ret = set_report(pfd.fd, &ev.u.set_report);
+			break;
+		case UHID_GET_REPORT:
+			ret = get_report(pfd.fd, &ev.u.get_report);
+			break;
+		case UHID_OUTPUT:
+			ret = 0;
+			if (ev.u.output.size != PCM_REPORT_SIZE) {
+				fail("report of %u bytes", ev.u.output.size);
+				break;
+			}
+			gap = last ? now_ms() - last : 0;
+			if (gap > keepalive + LATE_MS)
+				fail("%ld ms without a report", gap);
+			longest = gap > longest ? gap : longest;
+			last = now_ms();
+			reports++;
+			if (ev.u.output.data[1] == PCM_REPORT_V2)
+				check_v2(ev.u.output.data);
+			else
+				check_legacy(ev.u.output.data);
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+		if (ret)
+			return 2;
+	}
+
+	ev.type = UHID_DESTROY;
+	uhid_write(pfd.fd, &ev);
+	close(pfd.fd);
+
+	if (!reports)
+		fail("no reports in %ld s", seconds);
+	if (caps & PCM_CAP_V2 && !v2_reports)
+		fail("only legacy reports to v2 firmware");
+	printf("%lu reports, %lu v2, longest gap %ld ms, %lu failures\n",
+	       reports, v2_reports, longest, failures);
+	return failures ? 1 : 0;
+}
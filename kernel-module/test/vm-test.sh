@@ -0,0 +1,32 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Loads hid_pcmeter.ko in a VM started by virtme-ng (vng) and runs
+# test/uhid_pcmeter against it, once for every kind of firmware.
+#
+#   make vm-test [VM_KERNEL=path/to/linux] [VM_SECONDS=10]
+#
+# VM_KERNEL is a kernel build tree to boot, the module has to be built
+# against it (make module KERNEL=...). Without one the VM boots the kernel
+# of the host. The kernel needs CONFIG_UHID.
+
+set -e
+cd "$(dirname "$0")/.."
+
+if [ "$1" != "--in-vm" ]; then
+	exec vng --run $VM_KERNEL --user root --exec "VM_SECONDS=${VM_SECONDS:-10} sh test/vm-test.sh --in-vm"
+fi
+
+modprobe uhid 2>/dev/null || true
+insmod hid_pcmeter.ko
+trap 'rmmod hid_pcmeter' EXIT
+
+status=0
+for firmware in "" -2 -l; do
+	echo "uhid_pcmeter ${firmware:-(v2 with per-core frames)}"
+	test/uhid_pcmeter $firmware -t "$VM_SECONDS" -k "$(cat /sys/module/hid_pcmeter/parameters/keepalive)" || status=1
+	# which reports the driver chose
+	dmesg | grep -i pcmeter | tail -n 3
+done
+
+exit $status
@@ -0,0 +1,43 @@
+//! How long a refresh of each metric takes, from /proc and /sys
+//! (ProcSource, Linux only) and from the sysinfo crate (SysinfoSource).
+//! The metrics are read again and again, so the sources compare by what a
+//! tick of the collector costs, not by the first reading.
+//!
+//!   cargo bench --bench sources
+
+use criterion::{criterion_group, criterion_main, Criterion};
+use pc_meterd::collect::{Metrics, Source, SysinfoSource};
+#[cfg(target_os = "linux")]
+use pc_meterd::procfs::ProcSource;
+
+fn sources() -> Vec<(&'static str, Box<dyn Source>)> {
+    let mut sources: Vec<(&'static str, Box<dyn Source>)> =
+        vec![("sysinfo", Box::new(SysinfoSource::new(true)))];
+
+    #[cfg(target_os = "linux")]
+    sources.push(("procfs", Box::new(ProcSource::new().expect("no /proc"))));
+    sources
+}
+
+/// One group per metric, with a function per source in it
+fn bench_sources(c: &mut Criterion) {
+    let mut sources = sources();
+    let mut m = Metrics::default();
+    let metrics: [(&str, fn(&mut dyn Source, &mut Metrics)); 4] = [
+        ("cpu", |s, m| s.cpu(m)),
+        ("memory", |s, m| s.memory(m)),
+        ("load", |s, m| s.load(m)),
+        ("temps", |s, m| s.temps(m)),
+    ];
+
+    for (metric, refresh) in metrics {
+        let mut group = c.benchmark_group(metric);
+        for (name, source) in sources.iter_mut() {
+            group.bench_function(*name, |b| b.iter(|| refresh(source.as_mut(), &mut m)));
+        }
+        group.finish();
+    }
+}
+
+criterion_group!(benches, bench_sources);
+criterion_main!(benches);
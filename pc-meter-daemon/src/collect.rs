@@ -0,0 +1,454 @@
+//! Refreshes only what the reports use, every source at its own cadence
+
+use std::time::{Duration, Instant};
+use sysinfo::{Components, Disks, System};
+
+#[cfg(target_os = "linux")]
+use crate::iostat::IoStat;
+#[cfg(target_os = "linux")]
+use crate::procfs::ProcSource;
+
+/// Disks and components that fit into the user report
+pub const DISKS_MAX: usize = 10;
+pub const COMPONENTS_MAX: usize = 20;
+
+/// How the samples of one report become its value
+#[derive(Clone, Copy, PartialEq, Eq, Debug, clap::ValueEnum)]
+pub enum Stat {
+    Mean,
+    Max,
+    P95,
+    Last,
+}
+
+/// The samples since the last report, in a ring that holds the samples of
+/// one report, so none are overwritten
+#[derive(Clone)]
+struct Window {
+    values: Vec<f32>,
+    len: usize,
+    next: usize,
+}
+
+impl Window {
+    fn new(size: usize) -> Self {
+        Window {
+            values: vec![0.0; size.max(1)],
+            len: 0,
+            next: 0,
+        }
+    }
+
+    fn push(&mut self, v: f32) {
+        let size = self.values.len();
+
+        self.values[self.next] = v;
+        self.next = (self.next + 1) % size;
+        self.len = (self.len + 1).min(size);
+    }
+
+    /// The statistic of the samples, which are dropped then. 0 without samples.
+    fn take(&mut self, stat: Stat) -> f32 {
+        let size = self.values.len();
+        let len = std::mem::take(&mut self.len);
+        let last = self.values[(self.next + size - 1) % size];
+        // the order does not matter for the others
+        let values = &mut self.values[..len];
+
+        self.next = 0;
+        if len == 0 {
+            return 0.0;
+        }
+        match stat {
+            Stat::Mean => values.iter().sum::<f32>() / len as f32,
+            Stat::Max => values.iter().copied().fold(f32::MIN, f32::max),
+            Stat::Last => last,
+            Stat::P95 => {
+                // nearest rank
+                let rank = (len * 95).div_ceil(100) - 1;
+                *values.select_nth_unstable_by(rank, f32::total_cmp).1
+            }
+        }
+    }
+}
+
+/// A source that is refreshed at most every `every`
+struct Cadence {
+    every: Duration,
+    last: Option<Instant>,
+}
+
+impl Cadence {
+    fn new(every: Duration) -> Self {
+        Cadence { every, last: None }
+    }
+
+    fn due(&mut self, now: Instant) -> bool {
+        match self.last {
+            Some(last) if now.duration_since(last) < self.every => false,
+            _ => {
+                self.last = Some(now);
+                true
+            }
+        }
+    }
+}
+
+/// How long the refreshes and samples take, printed and reset with `take_summary`
+#[derive(Default)]
+pub struct Timing {
+    ticks: u32,
+    total: Duration,
+    max: Duration,
+    samples: u32,
+    sample_total: Duration,
+}
+
+impl Timing {
+    fn add(&mut self, took: Duration) {
+        self.ticks += 1;
+        self.total += took;
+        self.max = self.max.max(took);
+    }
+
+    fn add_sample(&mut self, took: Duration) {
+        self.samples += 1;
+        self.sample_total += took;
+    }
+}
+
+/// What the I/O report scales the throughput against
+#[derive(Clone, Copy)]
+pub struct IoLimits {
+    /// bytes per second read or written by one disk
+    pub disk_bytes: f64,
+    /// I/Os per second of one disk
+    pub disk_iops: f64,
+    /// bytes per second of every NIC, None for the speed each NIC negotiated
+    pub net_bytes: Option<f64>,
+}
+
+/// percent of the time busy, and of the limits
+#[derive(Clone, Copy, Default)]
+pub struct DiskIo {
+    pub util: f32,
+    pub read: f32,
+    pub write: f32,
+    pub iops: f32,
+}
+
+/// percent of the line rate
+#[derive(Clone, Copy, Default)]
+pub struct NetIo {
+    pub rx: f32,
+    pub tx: f32,
+}
+
+/// The values the reports are built from
+#[derive(Default)]
+pub struct Metrics {
+    /// percent
+    pub cpu: f32,
+    /// percent, by CPU id
+    pub cores: Vec<f32>,
+    pub cpus: usize,
+    pub mem_used: u64,
+    pub mem_total: u64,
+    pub swap_used: u64,
+    pub swap_total: u64,
+    pub load: [f64; 3],
+    pub disks: usize,
+    /// available and total space of the first DISKS_MAX disks
+    pub disk_space: Vec<(u64, u64)>,
+    /// degrees Celsius of the first COMPONENTS_MAX components
+    pub temps: Vec<f32>,
+    /// throughput of the disks and NICs of the I/O report
+    pub disk_io: Vec<DiskIo>,
+    pub net_io: Vec<NetIo>,
+}
+
+/// Where CPU, memory, load and temperatures come from
+pub trait Source {
+    fn cpu(&mut self, m: &mut Metrics);
+    /// RAM and swap
+    fn memory(&mut self, m: &mut Metrics);
+    fn load(&mut self, m: &mut Metrics);
+    fn temps(&mut self, m: &mut Metrics);
+    /// The components in the order of their temperatures
+    fn components(&self) -> Vec<String>;
+}
+
+/// The sysinfo crate, for every system
+pub struct SysinfoSource {
+    sys: System,
+    components: Components,
+}
+
+impl SysinfoSource {
+    pub fn new(cpu: bool) -> Self {
+        let mut sys = System::new();
+
+        // the first usage needs a reading to compare with
+        if cpu {
+            sys.refresh_cpu_usage();
+        }
+        SysinfoSource {
+            sys,
+            components: Components::new_with_refreshed_list(),
+        }
+    }
+}
+
+impl Source for SysinfoSource {
+    fn cpu(&mut self, m: &mut Metrics) {
+        self.sys.refresh_cpu_usage();
+        m.cpu = self.sys.global_cpu_info().cpu_usage();
+        m.cpus = self.sys.cpus().len();
+        m.cores.clear();
+        m.cores
+            .extend(self.sys.cpus().iter().map(|cpu| cpu.cpu_usage()));
+    }
+
+    fn memory(&mut self, m: &mut Metrics) {
+        self.sys.refresh_memory();
+        m.mem_used = self.sys.used_memory();
+        m.mem_total = self.sys.total_memory();
+        m.swap_used = self.sys.used_swap();
+        m.swap_total = self.sys.total_swap();
+    }
+
+    fn load(&mut self, m: &mut Metrics) {
+        let load_avg = System::load_average();
+
+        m.load = [load_avg.one, load_avg.five, load_avg.fifteen];
+    }
+
+    fn temps(&mut self, m: &mut Metrics) {
+        m.temps.clear();
+        for component in self.components.list_mut().iter_mut().take(COMPONENTS_MAX) {
+            component.refresh();
+            m.temps.push(component.temperature());
+        }
+    }
+
+    fn components(&self) -> Vec<String> {
+        self.components
+            .iter()
+            .map(|component| format!("{:?}", component))
+            .collect()
+    }
+}
+
+/// The statistic of every field that is sampled between reports
+#[derive(Clone, Copy)]
+pub struct Stats {
+    pub cpu: Stat,
+    pub mem: Stat,
+}
+
+/// The samples of the fields that are cheap enough to read between reports
+struct Windows {
+    cpu: Window,
+    /// by CPU id
+    cores: Vec<Window>,
+    mem_used: Window,
+    /// samples of one report
+    size: usize,
+}
+
+impl Windows {
+    fn new(size: usize) -> Self {
+        Windows {
+            cpu: Window::new(size),
+            cores: Vec::new(),
+            mem_used: Window::new(size),
+            size,
+        }
+    }
+}
+
+pub struct Collector {
+    pub metrics: Metrics,
+    pub disks: Disks,
+    source: Box<dyn Source>,
+    /// what a sample reads into, the windows keep the values
+    sample: Metrics,
+    windows: Windows,
+    stats: Stats,
+    #[cfg(target_os = "linux")]
+    io: Option<IoStat>,
+    cpu: bool,
+    disks_every: Cadence,
+    components_every: Cadence,
+    timing: Timing,
+}
+
+impl Collector {
+    /// Without `cpu` the CPUs are never read, they are only needed for the
+    /// system report. On Linux /proc and /sys are read directly unless
+    /// `sysinfo` is set. `stats` turn the samples taken between two refreshes,
+    /// up to `samples` of them, into the values of the report. With `io` the
+    /// throughput of disks and NICs is read as well, only on Linux.
+    pub fn new(
+        cpu: bool,
+        sysinfo: bool,
+        samples: usize,
+        stats: Stats,
+        io: Option<IoLimits>,
+        disks_every: Duration,
+        components_every: Duration,
+    ) -> Self {
+        #[cfg(not(target_os = "linux"))]
+        if io.is_some() {
+            eprintln!("No I/O report: it needs /proc/diskstats and /proc/net/dev");
+        }
+        Collector {
+            metrics: Metrics::default(),
+            disks: Disks::new_with_refreshed_list(),
+            source: Self::source(cpu, sysinfo),
+            sample: Metrics::default(),
+            windows: Windows::new(samples),
+            stats,
+            #[cfg(target_os = "linux")]
+            io: io.and_then(|limits| {
+                IoStat::new(limits)
+                    .map_err(|e| eprintln!("No I/O report: {}", e))
+                    .ok()
+            }),
+            cpu,
+            disks_every: Cadence::new(disks_every),
+            components_every: Cadence::new(components_every),
+            timing: Timing::default(),
+        }
+    }
+
+    #[cfg(target_os = "linux")]
+    fn source(cpu: bool, sysinfo: bool) -> Box<dyn Source> {
+        if !sysinfo {
+            match ProcSource::new() {
+                Ok(source) => return Box::new(source),
+                Err(e) => eprintln!("Falling back to sysinfo: {}", e),
+            }
+        }
+        Box::new(SysinfoSource::new(cpu))
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    fn source(cpu: bool, _sysinfo: bool) -> Box<dyn Source> {
+        Box::new(SysinfoSource::new(cpu))
+    }
+
+    /// Whether there is anything to send in the I/O report
+    #[cfg(target_os = "linux")]
+    pub fn has_io(&self) -> bool {
+        self.io.is_some()
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    pub fn has_io(&self) -> bool {
+        false
+    }
+
+    /// The disks and NICs in the order of the I/O report
+    #[cfg(target_os = "linux")]
+    pub fn io_devices(&self) -> (Vec<String>, Vec<String>) {
+        self.io.as_ref().map(|io| io.names()).unwrap_or_default()
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    pub fn io_devices(&self) -> (Vec<String>, Vec<String>) {
+        (Vec::new(), Vec::new())
+    }
+
+    /// Reads CPU and memory into the windows, between the refreshes
+    pub fn sample(&mut self) {
+        let start = Instant::now();
+
+        self.take_sample();
+        self.timing.add_sample(start.elapsed());
+    }
+
+    fn take_sample(&mut self) {
+        let (s, w) = (&mut self.sample, &mut self.windows);
+
+        if self.cpu {
+            self.source.cpu(s);
+            w.cpu.push(s.cpu);
+            if w.cores.len() < s.cores.len() {
+                w.cores.resize_with(s.cores.len(), || Window::new(w.size));
+            }
+            for (window, &core) in w.cores.iter_mut().zip(s.cores.iter()) {
+                window.push(core);
+            }
+        }
+        self.source.memory(s);
+        w.mem_used.push(s.mem_used as f32);
+    }
+
+    /// One report: a last sample of CPU and memory, whose windows become
+    /// the values, load and I/O every time, disks and components when they are due
+    pub fn refresh(&mut self) {
+        let start = Instant::now();
+
+        self.take_sample();
+        let (s, w, m) = (&self.sample, &mut self.windows, &mut self.metrics);
+        if self.cpu {
+            m.cpu = w.cpu.take(self.stats.cpu);
+            m.cpus = s.cpus;
+            m.cores.resize(w.cores.len(), 0.0);
+            for (core, window) in m.cores.iter_mut().zip(w.cores.iter_mut()) {
+                *core = window.take(self.stats.cpu);
+            }
+        }
+        m.mem_used = w.mem_used.take(self.stats.mem) as u64;
+        m.mem_total = s.mem_total;
+        m.swap_used = s.swap_used;
+        m.swap_total = s.swap_total;
+        self.source.load(m);
+        #[cfg(target_os = "linux")]
+        if let Some(io) = &mut self.io {
+            io.refresh(m);
+        }
+        if self.disks_every.due(start) {
+            m.disks = self.disks.list().len();
+            m.disk_space.clear();
+            for disk in self.disks.list_mut().iter_mut().take(DISKS_MAX) {
+                disk.refresh();
+                m.disk_space
+                    .push((disk.available_space(), disk.total_space()));
+            }
+        }
+        if self.components_every.due(start) {
+            self.source.temps(m);
+        }
+        self.timing.add(start.elapsed());
+    }
+
+    /// The components in the order of their temperatures in the report
+    pub fn components(&self) -> Vec<String> {
+        self.source.components()
+    }
+
+    /// "ticks, mean and max time of a refresh" since the last call, None without ticks
+    pub fn take_summary(&mut self) -> Option<String> {
+        let t = std::mem::take(&mut self.timing);
+
+        if t.ticks == 0 {
+            return None;
+        }
+        let mut summary = format!(
+            "{} ticks, refresh mean {} us, max {} us",
+            t.ticks,
+            (t.total / t.ticks).as_micros(),
+            t.max.as_micros()
+        );
+        if t.samples > 0 {
+            summary += &format!(
+                ", {} samples, mean {} us",
+                t.samples,
+                (t.sample_total / t.samples).as_micros()
+            );
+        }
+        Some(summary)
+    }
+}
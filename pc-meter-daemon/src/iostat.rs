@@ -0,0 +1,237 @@
+//! Disk and network throughput from the counters of /proc/diskstats and
+//! /proc/net/dev. Every refresh turns the difference to the last one into
+//! rates and scales them against the line rate or the most a disk does.
+
+use crate::collect::{DiskIo, IoLimits, Metrics, NetIo};
+use crate::procfs::{Pread, Scanner};
+use crate::protocol::{IO_DISKS_MAX, IO_NETS_MAX};
+use std::fs;
+use std::io;
+use std::path::Path;
+use std::time::Instant;
+
+/// diskstats counts in sectors of 512 bytes, whatever the disk uses
+const SECTOR: u64 = 512;
+/// Mbit/s of a NIC that does not tell its speed, e.g. WLAN
+const NET_SPEED_DEFAULT: u64 = 1000;
+
+/// Most a 32 bit counter may have gone around by to count as a wrap
+const WRAP_MAX: u64 = 1 << 30;
+
+/// The difference of a counter to its last reading. Some counters are
+/// only 32 bits wide (unsigned long on 32 bit systems, old NIC drivers)
+/// and wrap around. A counter that went back is taken as wrapped only if
+/// both readings fit 32 bits and it went around by less than a quarter of
+/// the range, otherwise it was reset (e.g. the driver was reloaded) and
+/// the delta is 0.
+fn counter_delta(now: u64, last: u64) -> u64 {
+    if now >= last {
+        now - last
+    } else if last <= u32::MAX as u64 && now + (1 << 32) - last <= WRAP_MAX {
+        now + (1 << 32) - last
+    } else {
+        0
+    }
+}
+
+/// Sectors read and written, I/Os completed and ms spent doing I/O
+#[derive(Clone, Copy)]
+struct DiskCounters {
+    read: u64,
+    written: u64,
+    ios: u64,
+    busy_ms: u64,
+}
+
+struct Disk {
+    name: String,
+    last: Option<DiskCounters>,
+}
+
+struct Nic {
+    name: String,
+    /// bytes per second at line rate
+    rate: f64,
+    /// bytes received and sent
+    last: Option<(u64, u64)>,
+}
+
+pub struct IoStat {
+    diskstats: Pread,
+    netdev: Pread,
+    disks: Vec<Disk>,
+    nics: Vec<Nic>,
+    limits: IoLimits,
+    last: Option<Instant>,
+}
+
+impl IoStat {
+    /// The disks and NICs are the ones that exist now, in the order of their names
+    pub fn new(limits: IoLimits) -> io::Result<Self> {
+        let disks = Self::devices("/sys/block", IO_DISKS_MAX);
+        let nics = Self::devices("/sys/class/net", IO_NETS_MAX);
+        let entries = |dir| fs::read_dir(dir).map(|dir| dir.count()).unwrap_or(0);
+
+        Ok(IoStat {
+            // a line for every block device and partition, not only the disks
+            diskstats: Pread::open("/proc/diskstats", 4096 + entries("/sys/class/block") * 192)?,
+            // and for every interface, also the virtual ones and those past IO_NETS_MAX
+            netdev: Pread::open("/proc/net/dev", 1024 + entries("/sys/class/net") * 192)?,
+            disks: disks
+                .into_iter()
+                .map(|name| Disk { name, last: None })
+                .collect(),
+            nics: nics
+                .into_iter()
+                .map(|name| Nic {
+                    rate: Self::line_rate(&name, &limits),
+                    name,
+                    last: None,
+                })
+                .collect(),
+            limits,
+            last: None,
+        })
+    }
+
+    /// The entries of dir that are hardware, loop devices, device mapper,
+    /// bridges, lo and the like have no device
+    fn devices(dir: &str, max: usize) -> Vec<String> {
+        let mut names: Vec<String> = match fs::read_dir(dir) {
+            Ok(entries) => entries
+                .filter_map(|e| e.ok())
+                .filter(|e| e.path().join("device").exists())
+                .map(|e| e.file_name().to_string_lossy().into_owned())
+                .collect(),
+            Err(_) => Vec::new(),
+        };
+        names.sort();
+        names.truncate(max);
+        names
+    }
+
+    /// --net-rate, or the speed the NIC negotiated
+    fn line_rate(name: &str, limits: &IoLimits) -> f64 {
+        if let Some(rate) = limits.net_bytes {
+            return rate;
+        }
+        let speed = fs::read_to_string(Path::new("/sys/class/net").join(name).join("speed"))
+            .ok()
+            .and_then(|s| s.trim().parse::<i64>().ok())
+            .filter(|&speed| speed > 0)
+            .map_or(NET_SPEED_DEFAULT, |speed| speed as u64);
+        (speed * 1_000_000 / 8) as f64
+    }
+
+    /// The disks and NICs in the order of the report
+    pub fn names(&self) -> (Vec<String>, Vec<String>) {
+        (
+            self.disks.iter().map(|disk| disk.name.clone()).collect(),
+            self.nics.iter().map(|nic| nic.name.clone()).collect(),
+        )
+    }
+
+    /// The rates since the last refresh in percent, 0 on the first one and
+    /// for devices that are gone
+    pub fn refresh(&mut self, m: &mut Metrics) {
+        let now = Instant::now();
+        let secs = self.last.map_or(0.0, |last| (now - last).as_secs_f64());
+
+        self.last = Some(now);
+        m.disk_io.clear();
+        m.disk_io.resize(self.disks.len(), DiskIo::default());
+        m.net_io.clear();
+        m.net_io.resize(self.nics.len(), NetIo::default());
+        self.read_disks(m, secs);
+        self.read_nics(m, secs);
+    }
+
+    /// "major minor name reads merged sectors ms writes merged sectors ms
+    /// in_flight io_ms weighted_ms ...", one line per block device
+    fn read_disks(&mut self, m: &mut Metrics, secs: f64) {
+        let limits = &self.limits;
+        let mut scan = Scanner::new(self.diskstats.read());
+
+        loop {
+            scan.u64();
+            scan.u64();
+            let name = scan.word();
+            if let Some(i) = self
+                .disks
+                .iter()
+                .position(|disk| disk.name.as_bytes() == name)
+            {
+                let reads = scan.u64();
+                scan.u64();
+                let read = scan.u64();
+                scan.u64();
+                let writes = scan.u64();
+                scan.u64();
+                let written = scan.u64();
+                scan.u64();
+                scan.u64();
+                let busy_ms = scan.u64();
+                let now = DiskCounters {
+                    read,
+                    written,
+                    ios: reads + writes,
+                    busy_ms,
+                };
+
+                if let Some(last) = self.disks[i].last.filter(|_| secs > 0.0) {
+                    let bytes = |now, last| (counter_delta(now, last) * SECTOR) as f64 / secs;
+                    m.disk_io[i] = DiskIo {
+                        util: (counter_delta(now.busy_ms, last.busy_ms) as f64 / 10.0 / secs)
+                            as f32,
+                        read: (bytes(now.read, last.read) * 100.0 / limits.disk_bytes) as f32,
+                        write: (bytes(now.written, last.written) * 100.0 / limits.disk_bytes)
+                            as f32,
+                        iops: (counter_delta(now.ios, last.ios) as f64 * 100.0
+                            / secs
+                            / limits.disk_iops) as f32,
+                    };
+                }
+                self.disks[i].last = Some(now);
+            }
+            if !scan.next_line() {
+                break;
+            }
+        }
+    }
+
+    /// Two lines of headers, then "name: rx_bytes packets errs drop fifo
+    /// frame compressed multicast tx_bytes ..." per interface
+    fn read_nics(&mut self, m: &mut Metrics, secs: f64) {
+        let mut scan = Scanner::new(self.netdev.read());
+
+        if !scan.next_line() || !scan.next_line() {
+            return;
+        }
+        loop {
+            let name = scan.word();
+            let name = name.strip_suffix(b":").unwrap_or(name);
+            if let Some(i) = self.nics.iter().position(|nic| nic.name.as_bytes() == name) {
+                let rx = scan.u64();
+                for _ in 0..7 {
+                    scan.u64();
+                }
+                let tx = scan.u64();
+                let nic = &mut self.nics[i];
+
+                if let Some((last_rx, last_tx)) = nic.last.filter(|_| secs > 0.0) {
+                    let percent = |now, last| {
+                        (counter_delta(now, last) as f64 * 100.0 / secs / nic.rate) as f32
+                    };
+                    m.net_io[i] = NetIo {
+                        rx: percent(rx, last_rx),
+                        tx: percent(tx, last_tx),
+                    };
+                }
+                nic.last = Some((rx, tx));
+            }
+            if !scan.next_line() {
+                break;
+            }
+        }
+    }
+}
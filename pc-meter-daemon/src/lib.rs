@@ -1,59 +1,300 @@
-use hidapi::{HidDevice, HidError};
-use sysinfo::{Components, Disks, System};
+pub mod collect;
+#[cfg(target_os = "linux")]
+mod iostat;
+#[cfg(target_os = "linux")]
+pub mod procfs;
+pub mod protocol;
+pub mod ticker;
+pub mod transport;
 
-const USER_REPORT: u8 = 1;
-const SYSTEM_REPORT: u8 = 0;
+use collect::Metrics;
+use protocol::*;
+use std::io;
+use std::time::Instant;
+use transport::Device;
 
-pub fn send_system_report(device: &HidDevice, sys: &System) -> Result<usize, HidError> {
-    let mut buf = [0u8; 64];
+/// Values of one report at their byte positions (see protocol.rs),
+/// in the unit of the legacy byte as Q8.8
+pub struct Report {
+    id: u8,
+    values: [u16; REPORT_SIZE],
+    len: usize,
+}
 
-    buf[0] = 0;
-    buf[1] = SYSTEM_REPORT;
-    buf[2] = sys.global_cpu_info().cpu_usage() as u8;
-    buf[3] = (sys.used_memory() * 100 / sys.total_memory()) as u8;
-    buf[4] = sys.cpus().len() as u8;
-    // buf 5..9 remain empty for now
-    for i in 0..sys.cpus().len() {
-        if i + 10 == buf.len() {
-            break;
+impl Report {
+    fn new(id: u8) -> Self {
+        Report {
+            id,
+            values: [0; REPORT_SIZE],
+            len: 2,
+        }
+    }
+
+    fn set(&mut self, byte: usize, value: u16) {
+        if byte < REPORT_SIZE {
+            self.values[byte] = value;
+            self.len = self.len.max(byte + 1);
+        }
+    }
+}
+
+/// Ask the device which report layouts it understands, old firmware does not answer
+pub fn query_caps(device: &dyn Device) -> u8 {
+    let mut buf = [0u8; REPORT_SIZE];
+
+    buf[1] = FEATURE_CMD_CAPS;
+    if device.send_feature_report(&buf).is_err() {
+        return CAP_LEGACY;
+    }
+    buf.fill(0);
+    match device.get_feature_report(&mut buf) {
+        Ok(len)
+            if len >= CAPS_LEN
+                && buf[1] == FEATURE_CMD_CAPS
+                && buf[CAPS_OFF_STATUS] == 0
+                && buf[CAPS_OFF_VERSION] >= V2_VERSION =>
+        {
+            buf[CAPS_OFF_CAPS]
+        }
+        _ => CAP_LEGACY,
+    }
+}
+
+/// Connection to one pcmeter-pico, sends v2 reports if the device understands them
+pub struct Link {
+    v2: bool,
+    cores: bool,
+    seq: u16,
+    flags: u8,
+    start: Instant,
+    frame: u16,
+    sent: Vec<u8>,
+    // kept between ticks, so sending does not allocate
+    parts: Vec<([u8; REPORT_SIZE], usize)>,
+    load: Vec<u8>,
+}
+
+impl Link {
+    pub fn new(device: &dyn Device) -> Self {
+        let caps = query_caps(device);
+
+        Link {
+            v2: caps & CAP_V2 != 0,
+            cores: caps & CAP_CORES != 0,
+            seq: 0,
+            flags: V2_FLAG_RESET,
+            start: Instant::now(),
+            frame: 0,
+            sent: Vec::new(),
+            parts: Vec::with_capacity(CORES_PARTS_MAX),
+            load: Vec::new(),
+        }
+    }
+
+    pub fn is_v2(&self) -> bool {
+        self.v2
+    }
+
+    /// The device takes the loads of all cores as TLV_CORES frames
+    pub fn has_cores(&self) -> bool {
+        self.v2 && self.cores
+    }
+
+    fn send(&mut self, device: &dyn Device, report: &Report) -> io::Result<usize> {
+        if self.v2 {
+            self.send_v2(device, report)
+        } else {
+            send_legacy(device, report)
+        }
+    }
+
+    /// One or more v2 reports, as many as the values need
+    fn send_v2(&mut self, device: &dyn Device, report: &Report) -> io::Result<usize> {
+        let mut buf = [0u8; REPORT_SIZE];
+        let now = self.start.elapsed().as_millis() as u32;
+        let mut sent = 2;
+        let mut written = 0;
+
+        while sent < report.len {
+            let mut off = v2_begin(&mut buf, STREAM_DAEMON, self.flags, self.seq, now);
+            self.seq = self.seq.wrapping_add(1);
+            self.flags = 0;
+            sent += v2_values(
+                &mut buf,
+                &mut off,
+                report.id,
+                sent as u8,
+                0,
+                &report.values[sent..report.len],
+            );
+            written += device.write(&buf)?;
+        }
+        Ok(written)
+    }
+
+    /// The loads of all cores (percent) as one frame over as many reports as
+    /// needed, only the cores that changed unless it is a keyframe.
+    /// The values of report go into the first part.
+    fn send_cores(
+        &mut self,
+        device: &dyn Device,
+        report: &Report,
+        load: &[u8],
+    ) -> io::Result<usize> {
+        let mut parts = std::mem::take(&mut self.parts);
+        let now = self.start.elapsed().as_millis() as u32;
+        let load = &load[..load.len().min(CORES_MAX)];
+        let full = self.flags & V2_FLAG_RESET != 0
+            || self.frame % CORES_KEYFRAME == 0
+            || self.sent.len() != load.len();
+        let (flags, prev) = if full {
+            (CORES_FLAG_FULL, None)
+        } else {
+            (0, Some(&self.sent[..]))
         };
-        buf[i + 10] = sys.cpus()[i].cpu_usage() as u8;
+        let mut core = 0;
+        let mut written = 0;
+
+        parts.clear();
+        loop {
+            let mut buf = [0u8; REPORT_SIZE];
+            let mut off = v2_begin(&mut buf, STREAM_DAEMON, self.flags, self.seq, now);
+            self.seq = self.seq.wrapping_add(1);
+            self.flags = 0;
+            if parts.is_empty() {
+                v2_values(
+                    &mut buf,
+                    &mut off,
+                    report.id,
+                    2,
+                    0,
+                    &report.values[2..report.len],
+                );
+            }
+            let parts_at;
+            (core, parts_at) = v2_cores(
+                &mut buf,
+                &mut off,
+                self.frame,
+                parts.len() as u8,
+                flags,
+                load,
+                prev,
+                core,
+            );
+            parts.push((buf, parts_at));
+            if core >= load.len() || parts.len() == CORES_PARTS_MAX {
+                break;
+            }
+        }
+        self.frame = self.frame.wrapping_add(1);
+
+        let count = parts.len() as u8;
+        let ret = parts.iter_mut().try_for_each(|(buf, parts_at)| {
+            buf[*parts_at] = count;
+            written += device.write(buf)?;
+            Ok::<_, io::Error>(())
+        });
+        self.parts = parts;
+        // a frame that did not go out in full is dropped by the firmware
+        ret?;
+        self.sent.clear();
+        self.sent.extend_from_slice(load);
+        Ok(written)
     }
+}
 
+/// The layout from before v2, one byte per value
+fn send_legacy(device: &dyn Device, report: &Report) -> io::Result<usize> {
+    let mut buf = [0u8; REPORT_SIZE];
+
+    buf[0] = 0;
+    buf[1] = report.id;
+    for i in 2..report.len {
+        buf[i] = (report.values[i] >> 8) as u8;
+    }
     device.write(&buf)
 }
 
-pub fn send_user_report(
-    device: &HidDevice,
-    sys: &System,
-    components: &Components,
-    disks: &Disks,
-) -> Result<usize, HidError> {
-    let mut buf = [0u8; 64];
-    let load_avg = System::load_average();
+pub fn send_system_report(device: &dyn Device, link: &mut Link, m: &Metrics) -> io::Result<usize> {
+    let mut report = Report::new(REPORT_SYSTEM);
 
-    buf[0] = 0;
-    buf[1] = USER_REPORT;
-    buf[2] = (sys.used_swap() * 100 / sys.total_swap()) as u8;
-    buf[3] = load_avg.one.floor() as u8;
-    buf[4] = load_avg.one.fract() as u8;
-    buf[5] = load_avg.five.floor() as u8;
-    buf[6] = load_avg.five.fract() as u8;
-    buf[7] = load_avg.fifteen.floor() as u8;
-    buf[8] = load_avg.fifteen.fract() as u8;
-    buf[9] = disks.list().len() as u8;
-    for i in 0..disks.list().len() {
-        buf[i + 10] =
-            (disks.list()[i].available_space() * 100 / disks.list()[i].total_space()) as u8;
-        if i == 9 {
-            break;
-        }; // write only until buf[19]
+    report.set(SYS_CPU, q8(m.cpu as f64));
+    report.set(SYS_MEM, percent_q8(m.mem_used, m.mem_total));
+    report.set(SYS_CPUS, q8(m.cpus.min(255) as f64));
+    // bytes 5..9 remain empty for now
+    if link.has_cores() {
+        let mut load = std::mem::take(&mut link.load);
+        load.clear();
+        load.extend(m.cores.iter().map(|usage| usage.clamp(0.0, 100.0) as u8));
+        let ret = link.send_cores(device, &report, &load);
+        link.load = load;
+        return ret;
     }
-    for i in 0..components.list().len() {
-        buf[i + 20] = components.list()[i].temperature() as u8;
-        if i == 19 {
+    for (i, usage) in m.cores.iter().enumerate() {
+        if SYS_CORE0 + i == REPORT_SIZE {
             break;
-        }; // write only until buf[39]
+        };
+        report.set(SYS_CORE0 + i, q8(*usage as f64));
     }
-    device.write(&buf)
+
+    link.send(device, &report)
+}
+
+pub fn send_user_report(device: &dyn Device, link: &mut Link, m: &Metrics) -> io::Result<usize> {
+    let mut report = Report::new(REPORT_USER);
+    let [one, five, fifteen] = m.load;
+
+    report.set(USER_SWAP, percent_q8(m.swap_used, m.swap_total));
+    report.set(USER_LOAD1, q8(one));
+    report.set(USER_LOAD1 + 1, q8((one.fract() * 100.0).floor()));
+    report.set(USER_LOAD5, q8(five));
+    report.set(USER_LOAD5 + 1, q8((five.fract() * 100.0).floor()));
+    report.set(USER_LOAD15, q8(fifteen));
+    report.set(USER_LOAD15 + 1, q8((fifteen.fract() * 100.0).floor()));
+    report.set(USER_DISKS, q8(m.disks.min(255) as f64));
+    // write only until byte 19, the collector has no more than DISKS_MAX
+    for (i, (available, total)) in m.disk_space.iter().enumerate() {
+        report.set(USER_DISK0 + i, percent_q8(*available, *total));
+    }
+    // write only until byte 39, the collector has no more than COMPONENTS_MAX
+    for (i, temp) in m.temps.iter().enumerate() {
+        report.set(USER_TEMP0 + i, q8(*temp as f64));
+    }
+
+    link.send(device, &report)
+}
+
+/// Throughput of disks and NICs, only sent to firmware that understands v2
+pub fn send_io_report(device: &dyn Device, link: &mut Link, m: &Metrics) -> io::Result<usize> {
+    let mut report = Report::new(REPORT_IO);
+    let percent = |v: f32| q8(v.clamp(0.0, 100.0) as f64);
+
+    if !link.is_v2() {
+        return Ok(0);
+    }
+    report.set(IO_DISKS, q8(m.disk_io.len() as f64));
+    report.set(IO_NETS, q8(m.net_io.len() as f64));
+    report.set(
+        IO_DISK_BUSIEST,
+        percent(m.disk_io.iter().map(|d| d.util).fold(0.0, f32::max)),
+    );
+    report.set(
+        IO_NET_BUSIEST,
+        percent(m.net_io.iter().map(|n| n.rx.max(n.tx)).fold(0.0, f32::max)),
+    );
+    for (i, disk) in m.disk_io.iter().take(IO_DISKS_MAX).enumerate() {
+        let at = IO_DISK0 + i * IO_DISK_STRIDE;
+        report.set(at + IO_DISK_UTIL, percent(disk.util));
+        report.set(at + IO_DISK_READ, percent(disk.read));
+        report.set(at + IO_DISK_WRITE, percent(disk.write));
+        report.set(at + IO_DISK_IOPS, percent(disk.iops));
+    }
+    for (i, nic) in m.net_io.iter().take(IO_NETS_MAX).enumerate() {
+        let at = IO_NET0 + i * IO_NET_STRIDE;
+        report.set(at + IO_NET_RX, percent(nic.rx));
+        report.set(at + IO_NET_TX, percent(nic.tx));
+    }
+
+    link.send(device, &report)
 }
@@ -1,8 +1,13 @@
-use clap::Parser;
-use hidapi::HidApi;
-use pc_meterd::{send_system_report, send_user_report};
-use std::{thread, time};
-use sysinfo::{Components, Disks, System};
+use clap::{error::ErrorKind, CommandFactory, Parser};
+use pc_meterd::{
+    collect::{Collector, IoLimits, Stat, Stats},
+    protocol::{IO_DISK0, IO_DISK_STRIDE, IO_NET0, IO_NET_STRIDE},
+    send_io_report, send_system_report, send_user_report,
+    ticker::{wait_ticks, Event, Ticker},
+    transport::Transport,
+    Link,
+};
+use std::{io, time};
 
 const VID: u16 = 0x2e8a;
 const PID: u16 = 0xc011;
@@ -22,20 +27,118 @@ struct Args {
     #[arg(short = 'd', long, default_value_t = false)]
     /// Print the disks list with buffer positions and exit
     pub disks: bool,
+    /// Time between refreshes of the disk usage (ms)
+    #[arg(long, default_value_t = 10000)]
+    pub disk_interval: u64,
+    /// Time between refreshes of the temperatures (ms)
+    #[arg(long, default_value_t = 5000)]
+    pub temp_interval: u64,
+    /// Print how long collecting the data takes, once a minute
+    #[arg(short = 't', long, default_value_t = false)]
+    pub timing: bool,
+    /// Read CPU, memory and temperatures with sysinfo instead of /proc and /sys (Linux)
+    #[arg(long, default_value_t = false)]
+    pub sysinfo: bool,
+    /// Time between samples of CPU and memory within an interval, 0 to sample once per interval, else at least 50 and a divisor of the interval (ms)
+    #[arg(long, default_value_t = 0)]
+    pub sample_interval: u16,
+    /// What the CPU samples of an interval are sent as
+    #[arg(long, value_enum, default_value_t = Stat::Mean)]
+    pub cpu_stat: Stat,
+    /// What the memory samples of an interval are sent as
+    #[arg(long, value_enum, default_value_t = Stat::Last)]
+    pub mem_stat: Stat,
+    /// Send the I/O report with disk and network throughput (Linux, v2 firmware)
+    #[arg(long, default_value_t = false)]
+    pub io: bool,
+    /// Throughput of a disk shown as 100% in the I/O report (MB/s)
+    #[arg(long, default_value_t = 500)]
+    pub disk_rate: u32,
+    /// I/Os per second of a disk shown as 100% in the I/O report
+    #[arg(long, default_value_t = 10000)]
+    pub disk_iops: u32,
+    /// Throughput of a NIC shown as 100% in the I/O report, 0 for the speed of the link (Mbit/s)
+    #[arg(long, default_value_t = 0)]
+    pub net_rate: u32,
+}
+
+impl Args {
+    /// The interval of the ticker and every how many ticks a report is sent
+    fn ticks(&self) -> (u16, u32) {
+        match self.sample_interval {
+            0 => (self.interval, 1),
+            sample if sample >= self.interval => (self.interval, 1),
+            sample if sample < SAMPLE_INTERVAL_MIN => Args::command()
+                .error(
+                    ErrorKind::InvalidValue,
+                    format!("--sample-interval must be 0 or at least {SAMPLE_INTERVAL_MIN} ms"),
+                )
+                .exit(),
+            sample if self.interval % sample != 0 => Args::command()
+                .error(
+                    ErrorKind::ArgumentConflict,
+                    format!(
+                        "--interval {} is not a multiple of --sample-interval {}",
+                        self.interval, sample
+                    ),
+                )
+                .exit(),
+            sample => (sample, (self.interval / sample) as u32),
+        }
+    }
+
+    fn collector(&self) -> Collector {
+        Collector::new(
+            self.system,
+            self.sysinfo,
+            self.ticks().1 as usize,
+            Stats {
+                cpu: self.cpu_stat,
+                mem: self.mem_stat,
+            },
+            self.io.then_some(IoLimits {
+                disk_bytes: self.disk_rate as f64 * 1e6,
+                disk_iops: self.disk_iops as f64,
+                net_bytes: (self.net_rate > 0).then_some(self.net_rate as f64 * 1e6 / 8.0),
+            }),
+            time::Duration::from_millis(self.disk_interval),
+            time::Duration::from_millis(self.temp_interval),
+        )
+    }
+}
+
+/// The kernel counts CPU time in steps of 10 ms (USER_HZ), shorter sample
+/// intervals would show those steps more than the load
+const SAMPLE_INTERVAL_MIN: u16 = 50;
+
+const TIMING_EVERY: time::Duration = time::Duration::from_secs(60);
+
+/// A report the Pico can not take right now is dropped, the next one has
+/// newer values anyway. Any other error means the Pico is gone.
+fn written(ret: io::Result<usize>, dropped: &mut u32) -> io::Result<()> {
+    match ret {
+        Err(e) if e.kind() == io::ErrorKind::WouldBlock => {
+            *dropped += 1;
+            Ok(())
+        }
+        ret => ret.map(|_| ()),
+    }
 }
 
 fn main() {
     let args = Args::parse();
-    let interval = time::Duration::from_millis(args.interval.into());
-    let api = HidApi::new().expect("Failed to create API instance");
+    // the ticker runs at the sample interval, every per_report-th tick is a report
+    let (tick, per_report) = args.ticks();
+    let interval = time::Duration::from_millis(tick.into());
+    let mut transport = Transport::new(VID, PID).expect("Failed to create the transport");
 
-    let mut sys = System::new_all();
-    let mut comp = Components::new_with_refreshed_list();
-    let mut disks = Disks::new_with_refreshed_list();
+    let mut collector = args.collector();
+    let mut timing_since = time::Instant::now();
+    let mut dropped = 0;
 
     if args.components {
         let mut i = 20;
-        for component in comp.iter() {
+        for component in collector.components() {
             println!("buf[{i}]: {component:?}");
             i += 1;
         }
@@ -43,37 +146,122 @@ fn main() {
     }
     if args.disks {
         let mut i = 10;
-        for disk in disks.iter() {
+        for disk in collector.disks.iter() {
             println!("buf[{i}]: {disk:?}");
             i += 1;
         }
+        let (disks, nics) = collector.io_devices();
+        for (i, disk) in disks.iter().enumerate() {
+            println!(
+                "I/O report buf[{}]: {}",
+                IO_DISK0 + i * IO_DISK_STRIDE,
+                disk
+            );
+        }
+        for (i, nic) in nics.iter().enumerate() {
+            println!("I/O report buf[{}]: {}", IO_NET0 + i * IO_NET_STRIDE, nic);
+        }
         return;
     }
 
+    let mut ticker = Ticker::new(interval).expect("Failed to create the tick timer");
+    #[cfg(target_os = "linux")]
+    if let Some(fd) = transport.hotplug_fd() {
+        ticker
+            .watch(fd)
+            .expect("Failed to watch for hotplug events");
+    }
     loop {
-        let pcmeter = api.open(VID, PID);
-        match pcmeter {
-            Ok(device) => loop {
-                sys.refresh_all();
-                comp.refresh();
-                disks.refresh();
+        let pcmeter = transport.open();
+        let event = match pcmeter {
+            Ok(device) => {
+                let mut link = Link::new(&device);
+                let mut ticks = 0;
+                println!(
+                    "Connected, using {} reports",
+                    if link.is_v2() { "v2" } else { "legacy" }
+                );
+                if collector.has_io() && !link.is_v2() {
+                    eprintln!("The firmware does not understand v2, no I/O report");
+                }
+                loop {
+                    match ticker.wait().expect("Failed to wait for the tick timer") {
+                        // missed samples are not taken again, but count towards the report
+                        Event::Tick { missed, .. } => ticks += 1 + missed,
+                        Event::Hotplug => {
+                            transport.hotplugged();
+                            continue;
+                        }
+                        ev => break Some(ev),
+                    }
+                    if ticks < per_report as u64 {
+                        collector.sample();
+                        continue;
+                    }
+                    ticks = 0;
+                    collector.refresh();
+                    if args.timing && timing_since.elapsed() >= TIMING_EVERY {
+                        for summary in [collector.take_summary(), ticker.take_summary()]
+                            .into_iter()
+                            .flatten()
+                        {
+                            println!("{}", summary);
+                        }
+                        if dropped > 0 {
+                            println!("{} reports dropped, the Pico was busy", dropped);
+                            dropped = 0;
+                        }
+                        timing_since = time::Instant::now();
+                    }
 
-                if args.system {
-                    if let Err(e) = send_system_report(&device, &sys) {
+                    if args.system {
+                        if let Err(e) = written(
+                            send_system_report(&device, &mut link, &collector.metrics),
+                            &mut dropped,
+                        ) {
+                            eprintln!("Write error: {}, device disconnected?", e);
+                            break None;
+                        }
+                    }
+                    if let Err(e) = written(
+                        send_user_report(&device, &mut link, &collector.metrics),
+                        &mut dropped,
+                    ) {
                         eprintln!("Write error: {}, device disconnected?", e);
-                        break;
+                        break None;
+                    }
+                    if collector.has_io() {
+                        if let Err(e) = written(
+                            send_io_report(&device, &mut link, &collector.metrics),
+                            &mut dropped,
+                        ) {
+                            eprintln!("Write error: {}, device disconnected?", e);
+                            break None;
+                        }
                     }
                 }
-                if let Err(e) = send_user_report(&device, &sys, &comp, &disks) {
-                    eprintln!("Write error: {}, device disconnected?", e);
-                    break;
-                }
-                thread::sleep(interval);
-            },
+            }
             Err(e) => {
                 eprintln!("Failed to open device: {}", e);
-                thread::sleep(interval * 10);
+                // try again after 10 intervals, or right when a hidraw node appears
+                loop {
+                    match wait_ticks(&mut ticker, 10 * per_report)
+                        .expect("Failed to wait for the tick timer")
+                    {
+                        Some(Event::Hotplug) if !transport.hotplugged() => (),
+                        ev => break ev,
+                    }
+                }
+            }
+        };
+
+        match event {
+            Some(Event::Quit) => return,
+            Some(Event::Reload) => {
+                println!("Reloading");
+                collector = args.collector();
             }
+            _ => (),
         }
     }
 }
@@ -0,0 +1,314 @@
+//! CPU, memory, load and temperatures straight from /proc and /sys. The
+//! files stay open and are read with pread into buffers that are allocated
+//! once, only the fields the reports need are parsed.
+
+use crate::collect::{Metrics, Source, COMPONENTS_MAX};
+use std::fs::{self, File};
+use std::io;
+use std::os::unix::fs::FileExt;
+use std::path::Path;
+
+/// A file read from the start on every refresh
+pub(crate) struct Pread {
+    file: File,
+    buf: Vec<u8>,
+}
+
+impl Pread {
+    pub(crate) fn open<P: AsRef<Path>>(path: P, size: usize) -> io::Result<Self> {
+        Ok(Pread {
+            file: File::open(path)?,
+            buf: vec![0; size],
+        })
+    }
+
+    /// The start of the file, as much as fits into the buffer
+    pub(crate) fn read(&mut self) -> &[u8] {
+        let mut len = 0;
+
+        while len < self.buf.len() {
+            match self.file.read_at(&mut self.buf[len..], len as u64) {
+                Ok(0) | Err(_) => break,
+                Ok(n) => len += n,
+            }
+        }
+        &self.buf[..len]
+    }
+}
+
+/// Reads numbers and words from a buffer, spaces and tabs between them are skipped
+pub(crate) struct Scanner<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Scanner<'a> {
+    pub(crate) fn new(buf: &'a [u8]) -> Self {
+        Scanner { buf, pos: 0 }
+    }
+
+    fn skip_blanks(&mut self) {
+        while self.pos < self.buf.len() && matches!(self.buf[self.pos], b' ' | b'\t') {
+            self.pos += 1;
+        }
+    }
+
+    /// The next word up to a blank, colon or the end of the line
+    pub(crate) fn word(&mut self) -> &'a [u8] {
+        self.skip_blanks();
+        let start = self.pos;
+        while self.pos < self.buf.len()
+            && !matches!(self.buf[self.pos], b' ' | b'\t' | b'\n' | b':')
+        {
+            self.pos += 1;
+        }
+        if self.pos < self.buf.len() && self.buf[self.pos] == b':' {
+            self.pos += 1;
+        }
+        &self.buf[start..self.pos]
+    }
+
+    pub(crate) fn u64(&mut self) -> u64 {
+        let mut v: u64 = 0;
+
+        self.skip_blanks();
+        while self.pos < self.buf.len() && self.buf[self.pos].is_ascii_digit() {
+            v = v
+                .wrapping_mul(10)
+                .wrapping_add((self.buf[self.pos] - b'0') as u64);
+            self.pos += 1;
+        }
+        v
+    }
+
+    /// A decimal like 0.52 of /proc/loadavg
+    fn decimal(&mut self) -> f64 {
+        let mut v = self.u64() as f64;
+
+        if self.pos < self.buf.len() && self.buf[self.pos] == b'.' {
+            let mut scale = 1.0;
+            self.pos += 1;
+            while self.pos < self.buf.len() && self.buf[self.pos].is_ascii_digit() {
+                scale /= 10.0;
+                v += (self.buf[self.pos] - b'0') as f64 * scale;
+                self.pos += 1;
+            }
+        }
+        v
+    }
+
+    /// To the start of the next line, false at the end
+    pub(crate) fn next_line(&mut self) -> bool {
+        while self.pos < self.buf.len() && self.buf[self.pos] != b'\n' {
+            self.pos += 1;
+        }
+        self.pos += 1;
+        self.pos < self.buf.len()
+    }
+}
+
+/// Time spent of a CPU in USER_HZ
+#[derive(Clone, Copy, Default)]
+struct CpuTimes {
+    busy: u64,
+    idle: u64,
+}
+
+impl CpuTimes {
+    /// percent busy since last
+    fn usage(&self, last: &CpuTimes) -> f32 {
+        let busy = self.busy.saturating_sub(last.busy);
+        let total = busy + self.idle.saturating_sub(last.idle);
+
+        if total == 0 {
+            return 0.0;
+        }
+        (busy as f64 * 100.0 / total as f64) as f32
+    }
+}
+
+struct Hwmon {
+    name: String,
+    input: Pread,
+}
+
+pub struct ProcSource {
+    stat: Pread,
+    meminfo: Pread,
+    loadavg: Pread,
+    hwmon: Vec<Hwmon>,
+    total: CpuTimes,
+    /// by CPU id, with the refresh they are from
+    cores: Vec<(u64, CpuTimes)>,
+    refreshes: u64,
+}
+
+impl ProcSource {
+    pub fn new() -> io::Result<Self> {
+        let cpus = fs::read_dir("/sys/devices/system/cpu")
+            .map(|dir| dir.count())
+            .unwrap_or(0);
+
+        Ok(ProcSource {
+            // the cpu lines come first, the rest of /proc/stat is not read
+            stat: Pread::open("/proc/stat", 4096 + cpus * 160)?,
+            meminfo: Pread::open("/proc/meminfo", 8192)?,
+            loadavg: Pread::open("/proc/loadavg", 128)?,
+            hwmon: Self::hwmon(),
+            total: CpuTimes::default(),
+            cores: Vec::new(),
+            refreshes: 0,
+        })
+    }
+
+    /// The temp*_input of all hwmon devices, by device and input number
+    fn hwmon() -> Vec<Hwmon> {
+        let mut inputs = Vec::new();
+        let dirs = match fs::read_dir("/sys/class/hwmon") {
+            Ok(dirs) => dirs,
+            Err(_) => return inputs,
+        };
+        let mut dirs: Vec<_> = dirs.filter_map(|e| e.ok()).map(|e| e.path()).collect();
+        dirs.sort_by_key(|p| number_in(&p.to_string_lossy()));
+
+        for dir in dirs {
+            let device = fs::read_to_string(dir.join("name")).unwrap_or_default();
+            let mut temps: Vec<_> = match fs::read_dir(&dir) {
+                Ok(entries) => entries
+                    .filter_map(|e| e.ok())
+                    .map(|e| e.file_name().to_string_lossy().into_owned())
+                    .filter(|f| f.starts_with("temp") && f.ends_with("_input"))
+                    .collect(),
+                Err(_) => continue,
+            };
+            temps.sort_by_key(|f| number_in(f));
+
+            for temp in temps {
+                if inputs.len() == COMPONENTS_MAX {
+                    return inputs;
+                }
+                let label = fs::read_to_string(dir.join(temp.replace("_input", "_label")))
+                    .unwrap_or_else(|_| temp.trim_end_matches("_input").to_string());
+                if let Ok(input) = Pread::open(dir.join(&temp), 32) {
+                    inputs.push(Hwmon {
+                        name: format!("{} {}", device.trim(), label.trim()),
+                        input,
+                    });
+                }
+            }
+        }
+        inputs
+    }
+}
+
+/// The first number in s, e.g. 3 of "hwmon3" or "temp3_input"
+fn number_in(s: &str) -> u64 {
+    let mut scan = Scanner::new(s.as_bytes());
+
+    while scan.pos < scan.buf.len() && !scan.buf[scan.pos].is_ascii_digit() {
+        scan.pos += 1;
+    }
+    scan.u64()
+}
+
+impl Source for ProcSource {
+    /// "cpu  user nice system idle iowait irq softirq steal ..." and a "cpuN" line per online CPU
+    fn cpu(&mut self, m: &mut Metrics) {
+        let mut scan = Scanner::new(self.stat.read());
+
+        self.refreshes += 1;
+        m.cpus = 0;
+        for core in m.cores.iter_mut() {
+            *core = 0.0;
+        }
+        loop {
+            let name = scan.word();
+            if !name.starts_with(b"cpu") {
+                break;
+            }
+            let user = scan.u64();
+            let nice = scan.u64();
+            let system = scan.u64();
+            let idle = scan.u64();
+            let iowait = scan.u64();
+            let irq = scan.u64();
+            let softirq = scan.u64();
+            let steal = scan.u64();
+            let now = CpuTimes {
+                busy: user + nice + system + irq + softirq + steal,
+                idle: idle + iowait,
+            };
+
+            if name == b"cpu" {
+                m.cpu = now.usage(&self.total);
+                self.total = now;
+            } else {
+                let id = number_in(std::str::from_utf8(name).unwrap_or("")) as usize;
+                if id >= self.cores.len() {
+                    self.cores.resize(id + 1, (0, CpuTimes::default()));
+                    m.cores.resize(id + 1, 0.0);
+                }
+                // a CPU that was offline has nothing to compare with and reads 0 once
+                let (refresh, last) = &self.cores[id];
+                if *refresh + 1 == self.refreshes {
+                    m.cores[id] = now.usage(last);
+                }
+                self.cores[id] = (self.refreshes, now);
+                m.cpus += 1;
+            }
+            if !scan.next_line() {
+                break;
+            }
+        }
+    }
+
+    /// MemTotal, MemAvailable, SwapTotal and SwapFree in kB
+    fn memory(&mut self, m: &mut Metrics) {
+        let mut scan = Scanner::new(self.meminfo.read());
+        let (mut total, mut available, mut swap_total, mut swap_free) = (0, 0, 0, 0);
+        let mut found = 0;
+
+        while found < 4 {
+            let value = match scan.word() {
+                b"MemTotal:" => &mut total,
+                b"MemAvailable:" => &mut available,
+                b"SwapTotal:" => &mut swap_total,
+                b"SwapFree:" => &mut swap_free,
+                _ => {
+                    if !scan.next_line() {
+                        break;
+                    }
+                    continue;
+                }
+            };
+            *value = scan.u64() * 1024;
+            found += 1;
+            if !scan.next_line() {
+                break;
+            }
+        }
+        m.mem_total = total;
+        m.mem_used = total.saturating_sub(available);
+        m.swap_total = swap_total;
+        m.swap_used = swap_total.saturating_sub(swap_free);
+    }
+
+    fn load(&mut self, m: &mut Metrics) {
+        let mut scan = Scanner::new(self.loadavg.read());
+
+        m.load = [scan.decimal(), scan.decimal(), scan.decimal()];
+    }
+
+    /// millidegrees Celsius
+    fn temps(&mut self, m: &mut Metrics) {
+        m.temps.clear();
+        for hwmon in self.hwmon.iter_mut() {
+            m.temps
+                .push(Scanner::new(hwmon.input.read()).u64() as f32 / 1000.0);
+        }
+    }
+
+    fn components(&self) -> Vec<String> {
+        self.hwmon.iter().map(|hwmon| hwmon.name.clone()).collect()
+    }
+}
@@ -0,0 +1,220 @@
+//! Wire protocol between pc-meterd and the pcmeter-pico.
+//!
+//! This mirrors `protocol/pcmeter_protocol.h`, which documents the layout and
+//! is shared by the kernel module and the firmware. Keep both in sync.
+//! Offsets count like hidapi does: byte 0 is the HID report number (always 0).
+
+pub const REPORT_SIZE: usize = 64;
+
+// byte 1
+pub const REPORT_SYSTEM: u8 = 0x00;
+pub const REPORT_USER: u8 = 0x01;
+pub const REPORT_KERNEL: u8 = 0x02;
+pub const REPORT_IO: u8 = 0x03;
+pub const REPORT_V2: u8 = 0xa2;
+
+// layout of the legacy reports, v2 values use the same positions
+pub const SYS_CPU: usize = 2;
+pub const SYS_MEM: usize = 3;
+pub const SYS_CPUS: usize = 4;
+pub const SYS_CORE0: usize = 10;
+pub const USER_SWAP: usize = 2;
+pub const USER_LOAD1: usize = 3;
+pub const USER_LOAD5: usize = 5;
+pub const USER_LOAD15: usize = 7;
+pub const USER_DISKS: usize = 9;
+pub const USER_DISK0: usize = 10;
+pub const USER_TEMP0: usize = 20;
+pub const KERN_IOWAIT: usize = 2;
+pub const KERN_STEAL: usize = 3;
+pub const KERN_IRQ: usize = 4;
+pub const KERN_SOFTIRQ: usize = 5;
+pub const KERN_NODES: usize = 6;
+pub const KERN_NODE0: usize = 10;
+pub const IO_DISKS: usize = 2;
+pub const IO_NETS: usize = 3;
+pub const IO_DISK_BUSIEST: usize = 4;
+pub const IO_NET_BUSIEST: usize = 5;
+pub const IO_DISK0: usize = 10;
+pub const IO_DISK_STRIDE: usize = 4;
+pub const IO_DISK_UTIL: usize = 0;
+pub const IO_DISK_READ: usize = 1;
+pub const IO_DISK_WRITE: usize = 2;
+pub const IO_DISK_IOPS: usize = 3;
+pub const IO_DISKS_MAX: usize = 8;
+pub const IO_NET0: usize = 42;
+pub const IO_NET_STRIDE: usize = 2;
+pub const IO_NET_RX: usize = 0;
+pub const IO_NET_TX: usize = 1;
+pub const IO_NETS_MAX: usize = 10;
+
+// v2 header
+pub const V2_VERSION: u8 = 2;
+pub const V2_OFF_VERSION: usize = 2;
+pub const V2_OFF_STREAM: usize = 3;
+pub const V2_OFF_FLAGS: usize = 4;
+pub const V2_OFF_SEQ: usize = 5;
+pub const V2_OFF_TIME: usize = 7;
+pub const V2_OFF_TLV: usize = 11;
+
+pub const V2_FLAG_RESET: u8 = 0x01;
+
+pub const STREAM_KERNEL: u8 = 0;
+pub const STREAM_DAEMON: u8 = 1;
+
+// TLVs
+pub const TLV_END: u8 = 0x00;
+pub const TLV_VALUES: u8 = 0x01;
+pub const TLV_CORES: u8 = 0x02;
+pub const TLV_HDR: usize = 2;
+pub const TLV_VALUES_HDR: usize = 4;
+
+// TLV_CORES
+pub const CORES_HDR: usize = 7;
+pub const CORES_OFF_PARTS: usize = 3;
+pub const CORES_RUN_HDR: usize = 3;
+pub const CORES_FLAG_FULL: u8 = 0x01;
+pub const CORES_MAX: usize = 512;
+pub const CORES_PARTS_MAX: usize = 32;
+pub const CORES_KEYFRAME: u16 = 16;
+pub const CORES_GAP: usize = CORES_RUN_HDR;
+
+// capabilities
+pub const FEATURE_CMD_CAPS: u8 = 0x02;
+pub const CAPS_OFF_STATUS: usize = 2;
+pub const CAPS_OFF_CAPS: usize = 3;
+pub const CAPS_OFF_VERSION: usize = 4;
+pub const CAPS_LEN: usize = 18;
+
+pub const CAP_LEGACY: u8 = 0x01;
+pub const CAP_V2: u8 = 0x02;
+pub const CAP_CORES: u8 = 0x04;
+
+/// Start a v2 report, returns the offset of the first TLV
+pub fn v2_begin(
+    buf: &mut [u8; REPORT_SIZE],
+    stream: u8,
+    flags: u8,
+    seq: u16,
+    time_ms: u32,
+) -> usize {
+    buf.fill(0);
+    buf[1] = REPORT_V2;
+    buf[V2_OFF_VERSION] = V2_VERSION;
+    buf[V2_OFF_STREAM] = stream;
+    buf[V2_OFF_FLAGS] = flags;
+    buf[V2_OFF_SEQ..V2_OFF_SEQ + 2].copy_from_slice(&seq.to_le_bytes());
+    buf[V2_OFF_TIME..V2_OFF_TIME + 4].copy_from_slice(&time_ms.to_le_bytes());
+    V2_OFF_TLV
+}
+
+/// Append a TLV_VALUES at off with as many of the values as fit.
+/// Returns how many were written, off is moved behind the TLV.
+pub fn v2_values(
+    buf: &mut [u8; REPORT_SIZE],
+    off: &mut usize,
+    report: u8,
+    first: u8,
+    age_ms: u16,
+    values: &[u16],
+) -> usize {
+    let room = REPORT_SIZE.saturating_sub(*off + TLV_HDR + TLV_VALUES_HDR) / 2;
+    let count = values.len().min(room);
+    if count == 0 {
+        return 0;
+    }
+    let p = &mut buf[*off..];
+    p[0] = TLV_VALUES;
+    p[1] = (TLV_VALUES_HDR + count * 2) as u8;
+    p[2] = report;
+    p[3] = first;
+    p[4..6].copy_from_slice(&age_ms.to_le_bytes());
+    for (i, v) in values[..count].iter().enumerate() {
+        let at = TLV_HDR + TLV_VALUES_HDR + i * 2;
+        p[at..at + 2].copy_from_slice(&v.to_le_bytes());
+    }
+    *off += TLV_HDR + TLV_VALUES_HDR + count * 2;
+    count
+}
+
+/// Append a TLV_CORES at off with the runs of the cores from core on that
+/// differ from prev, or all of them without prev. Returns the first core that
+/// did not fit and where the number of parts goes, which is written when the
+/// frame is complete.
+#[allow(clippy::too_many_arguments)]
+pub fn v2_cores(
+    buf: &mut [u8; REPORT_SIZE],
+    off: &mut usize,
+    frame: u16,
+    part: u8,
+    flags: u8,
+    load: &[u8],
+    prev: Option<&[u8]>,
+    core: usize,
+) -> (usize, usize) {
+    let ncores = load.len();
+    let room = (REPORT_SIZE - *off - TLV_HDR).min(255);
+    let unchanged = |c: usize| prev.is_some_and(|p| p[c] == load[c]);
+    let p = &mut buf[*off..];
+    let mut len = CORES_HDR;
+    let mut c = core;
+
+    p[0] = TLV_CORES;
+    p[2..4].copy_from_slice(&frame.to_le_bytes());
+    p[4] = part;
+    p[5] = 0;
+    p[6..8].copy_from_slice(&(ncores as u16).to_le_bytes());
+    p[8] = flags;
+
+    while c < ncores {
+        // next core that changed
+        if unchanged(c) {
+            c += 1;
+            continue;
+        }
+        if len + CORES_RUN_HDR + 1 > room {
+            break;
+        }
+
+        // grow the run over changed cores and short gaps of unchanged ones
+        let mut end = c + 1;
+        while end < ncores {
+            let mut gap = 0;
+            while end + gap < ncores && gap <= CORES_GAP && unchanged(end + gap) {
+                gap += 1;
+            }
+            if end + gap >= ncores || gap > CORES_GAP {
+                break;
+            }
+            if len + CORES_RUN_HDR + (end + gap + 1 - c) > room || end + gap + 1 - c > 255 {
+                break;
+            }
+            end += gap + 1;
+        }
+
+        let run = &mut p[TLV_HDR + len..];
+        run[0..2].copy_from_slice(&(c as u16).to_le_bytes());
+        run[2] = (end - c) as u8;
+        run[CORES_RUN_HDR..CORES_RUN_HDR + end - c].copy_from_slice(&load[c..end]);
+        len += CORES_RUN_HDR + (end - c);
+        c = end;
+    }
+
+    p[1] = len as u8;
+    let parts_at = *off + TLV_HDR + CORES_OFF_PARTS;
+    *off += TLV_HDR + len;
+    (c, parts_at)
+}
+
+/// Value in the unit of the legacy byte as Q8.8, saturating
+pub fn q8(v: f64) -> u16 {
+    (v * 256.0).clamp(0.0, u16::MAX as f64) as u16
+}
+
+/// part of total in percent as Q8.8
+pub fn percent_q8(part: u64, total: u64) -> u16 {
+    if total == 0 {
+        return 0;
+    }
+    (part as u128 * 25600 / total as u128).min(u16::MAX as u128) as u16
+}
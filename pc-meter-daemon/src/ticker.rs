@@ -0,0 +1,301 @@
+//! The clock of the daemon: ticks at fixed deadlines, so the time spent on a
+//! tick does not move the next one, and the signals that stop or reload it.
+
+use std::io;
+use std::time::Duration;
+
+pub enum Event {
+    /// A deadline was reached. `missed` deadlines passed without a tick
+    /// before this one, `late` is how far behind its deadline it came.
+    Tick { missed: u64, late: Duration },
+    /// SIGHUP, read the lists of disks and components again and reconnect
+    Reload,
+    /// The fd given to `watch` is readable
+    Hotplug,
+    /// SIGINT or SIGTERM
+    Quit,
+}
+
+/// How far behind the ticks come, printed and reset with `take_summary`
+#[derive(Default)]
+struct Lateness {
+    ticks: u32,
+    missed: u64,
+    total: Duration,
+    max: Duration,
+}
+
+impl Lateness {
+    fn add(&mut self, missed: u64, late: Duration) {
+        self.ticks += 1;
+        self.missed += missed;
+        self.total += late;
+        self.max = self.max.max(late);
+    }
+
+    fn take_summary(&mut self) -> Option<String> {
+        let l = std::mem::take(self);
+
+        if l.ticks == 0 {
+            return None;
+        }
+        Some(format!(
+            "tick late mean {} us, max {} us, {} ticks missed",
+            (l.total / l.ticks).as_micros(),
+            l.max.as_micros(),
+            l.missed
+        ))
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod imp {
+    use super::{Event, Lateness};
+    use std::io;
+    use std::mem::{size_of, MaybeUninit};
+    use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+    use std::time::Duration;
+
+    const TOKEN_TIMER: u64 = 0;
+    const TOKEN_SIGNAL: u64 = 1;
+    const TOKEN_HOTPLUG: u64 = 2;
+
+    fn check(ret: libc::c_int) -> io::Result<libc::c_int> {
+        if ret < 0 {
+            Err(io::Error::last_os_error())
+        } else {
+            Ok(ret)
+        }
+    }
+
+    fn timespec(d: Duration) -> libc::timespec {
+        libc::timespec {
+            tv_sec: d.as_secs() as libc::time_t,
+            tv_nsec: d.subsec_nanos() as libc::c_long,
+        }
+    }
+
+    fn monotonic() -> Duration {
+        let mut ts = MaybeUninit::<libc::timespec>::uninit();
+
+        // CLOCK_MONOTONIC can not fail
+        unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, ts.as_mut_ptr()) };
+        let ts = unsafe { ts.assume_init() };
+        Duration::new(ts.tv_sec as u64, ts.tv_nsec as u32)
+    }
+
+    /// A timerfd with absolute deadlines and a signalfd in one epoll
+    pub struct Ticker {
+        epoll: OwnedFd,
+        timer: OwnedFd,
+        signals: OwnedFd,
+        interval: Duration,
+        deadline: Duration,
+        lateness: Lateness,
+    }
+
+    impl Ticker {
+        /// Blocks SIGINT, SIGTERM and SIGHUP for the calling thread, they
+        /// arrive through `wait` instead. Call it before starting threads.
+        pub fn new(interval: Duration) -> io::Result<Self> {
+            let now = monotonic();
+            let spec = libc::itimerspec {
+                it_interval: timespec(interval),
+                it_value: timespec(now + interval),
+            };
+            let mut mask = MaybeUninit::<libc::sigset_t>::uninit();
+
+            let timer = unsafe {
+                OwnedFd::from_raw_fd(check(libc::timerfd_create(
+                    libc::CLOCK_MONOTONIC,
+                    libc::TFD_CLOEXEC,
+                ))?)
+            };
+            check(unsafe {
+                libc::timerfd_settime(
+                    timer.as_raw_fd(),
+                    libc::TFD_TIMER_ABSTIME,
+                    &spec,
+                    std::ptr::null_mut(),
+                )
+            })?;
+
+            let mask = unsafe {
+                libc::sigemptyset(mask.as_mut_ptr());
+                for sig in [libc::SIGINT, libc::SIGTERM, libc::SIGHUP] {
+                    libc::sigaddset(mask.as_mut_ptr(), sig);
+                }
+                mask.assume_init()
+            };
+            let ret =
+                unsafe { libc::pthread_sigmask(libc::SIG_BLOCK, &mask, std::ptr::null_mut()) };
+            if ret != 0 {
+                return Err(io::Error::from_raw_os_error(ret));
+            }
+            let signals = unsafe {
+                OwnedFd::from_raw_fd(check(libc::signalfd(-1, &mask, libc::SFD_CLOEXEC))?)
+            };
+
+            let epoll =
+                unsafe { OwnedFd::from_raw_fd(check(libc::epoll_create1(libc::EPOLL_CLOEXEC))?) };
+            for (fd, token) in [(&timer, TOKEN_TIMER), (&signals, TOKEN_SIGNAL)] {
+                let mut ev = libc::epoll_event {
+                    events: libc::EPOLLIN as u32,
+                    u64: token,
+                };
+                check(unsafe {
+                    libc::epoll_ctl(
+                        epoll.as_raw_fd(),
+                        libc::EPOLL_CTL_ADD,
+                        fd.as_raw_fd(),
+                        &mut ev,
+                    )
+                })?;
+            }
+
+            Ok(Ticker {
+                epoll,
+                timer,
+                signals,
+                interval,
+                deadline: now,
+                lateness: Lateness::default(),
+            })
+        }
+
+        /// Wake up for fd as well, it has to be read until it would block
+        pub fn watch(&mut self, fd: RawFd) -> io::Result<()> {
+            let mut ev = libc::epoll_event {
+                events: libc::EPOLLIN as u32,
+                u64: TOKEN_HOTPLUG,
+            };
+
+            check(unsafe {
+                libc::epoll_ctl(self.epoll.as_raw_fd(), libc::EPOLL_CTL_ADD, fd, &mut ev)
+            })?;
+            Ok(())
+        }
+
+        /// Waits for the next deadline, signal or hotplug event, in that order of preference
+        pub fn wait(&mut self) -> io::Result<Event> {
+            let mut events = [libc::epoll_event { events: 0, u64: 0 }; 3];
+
+            let n = loop {
+                match check(unsafe {
+                    libc::epoll_wait(self.epoll.as_raw_fd(), events.as_mut_ptr(), 3, -1)
+                }) {
+                    Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                    ret => break ret? as usize,
+                }
+            };
+            let events = &events[..n];
+
+            if events.iter().any(|ev| ev.u64 == TOKEN_SIGNAL) {
+                return self.read_signal();
+            }
+            if events.iter().any(|ev| ev.u64 == TOKEN_TIMER) {
+                return self.read_timer();
+            }
+            Ok(Event::Hotplug)
+        }
+
+        fn read_signal(&mut self) -> io::Result<Event> {
+            let mut info = MaybeUninit::<libc::signalfd_siginfo>::uninit();
+            let len = size_of::<libc::signalfd_siginfo>();
+
+            if unsafe { libc::read(self.signals.as_raw_fd(), info.as_mut_ptr().cast(), len) }
+                != len as isize
+            {
+                return Err(io::Error::last_os_error());
+            }
+            match unsafe { info.assume_init() }.ssi_signo as libc::c_int {
+                libc::SIGHUP => Ok(Event::Reload),
+                _ => Ok(Event::Quit),
+            }
+        }
+
+        fn read_timer(&mut self) -> io::Result<Event> {
+            let mut expired = 0u64;
+
+            if unsafe {
+                libc::read(
+                    self.timer.as_raw_fd(),
+                    (&mut expired as *mut u64).cast(),
+                    size_of::<u64>(),
+                )
+            } != size_of::<u64>() as isize
+            {
+                return Err(io::Error::last_os_error());
+            }
+            // the deadline of this tick is the last one that expired
+            self.deadline += self.interval * expired as u32;
+            let late = monotonic().saturating_sub(self.deadline);
+            self.lateness.add(expired - 1, late);
+
+            Ok(Event::Tick {
+                missed: expired - 1,
+                late,
+            })
+        }
+
+        pub fn take_summary(&mut self) -> Option<String> {
+            self.lateness.take_summary()
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod imp {
+    use super::{Event, Lateness};
+    use std::io;
+    use std::thread;
+    use std::time::{Duration, Instant};
+
+    /// Sleeps until absolute deadlines, without signals
+    pub struct Ticker {
+        interval: Duration,
+        next: Instant,
+        lateness: Lateness,
+    }
+
+    impl Ticker {
+        pub fn new(interval: Duration) -> io::Result<Self> {
+            Ok(Ticker {
+                interval,
+                next: Instant::now() + interval,
+                lateness: Lateness::default(),
+            })
+        }
+
+        pub fn wait(&mut self) -> io::Result<Event> {
+            let now = Instant::now();
+
+            if now < self.next {
+                thread::sleep(self.next - now);
+            }
+            let late = Instant::now().saturating_duration_since(self.next);
+            let missed = (late.as_nanos() / self.interval.as_nanos()) as u64;
+            self.next += self.interval * (missed + 1) as u32;
+            self.lateness.add(missed, late);
+
+            Ok(Event::Tick { missed, late })
+        }
+
+        pub fn take_summary(&mut self) -> Option<String> {
+            self.lateness.take_summary()
+        }
+    }
+}
+
+pub use imp::Ticker;
+
+/// Waits for `ticks` ticks, but returns a signal right away
+pub fn wait_ticks(ticker: &mut Ticker, ticks: u32) -> io::Result<Option<Event>> {
+    for _ in 0..ticks {
+        match ticker.wait()? {
+            Event::Tick { .. } => (),
+            ev => return Ok(Some(ev)),
+        }
+    }
+    Ok(None)
+}
@@ -0,0 +1,253 @@
+//! The way to the pcmeter-pico. On Linux its hidraw node is written
+//! directly and udev tells when it appears, elsewhere hidapi is used.
+
+use std::io;
+
+/// What the reports need of a device
+pub trait Device {
+    /// One output report, byte 0 is the report number. An error of kind
+    /// `WouldBlock` means the device can not take it now, it is dropped.
+    fn write(&self, buf: &[u8]) -> io::Result<usize>;
+    fn send_feature_report(&self, buf: &[u8]) -> io::Result<()>;
+    fn get_feature_report(&self, buf: &mut [u8]) -> io::Result<usize>;
+}
+
+#[cfg(target_os = "linux")]
+mod imp {
+    use super::Device;
+    use std::fs::{self, File, OpenOptions};
+    use std::io::{self, Write};
+    use std::mem::size_of;
+    use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+    use std::os::unix::fs::OpenOptionsExt;
+    use std::path::PathBuf;
+
+    /* _IOC(_IOC_WRITE | _IOC_READ, 'H', nr, len) of linux/hidraw.h */
+    #[cfg(any(
+        target_arch = "powerpc",
+        target_arch = "powerpc64",
+        target_arch = "mips",
+        target_arch = "mips64",
+        target_arch = "sparc",
+        target_arch = "sparc64"
+    ))]
+    const IOC_RW: u32 = 6 << 29;
+    #[cfg(not(any(
+        target_arch = "powerpc",
+        target_arch = "powerpc64",
+        target_arch = "mips",
+        target_arch = "mips64",
+        target_arch = "sparc",
+        target_arch = "sparc64"
+    )))]
+    const IOC_RW: u32 = 3 << 30;
+    const HIDIOCSFEATURE: u32 = 0x06;
+    const HIDIOCGFEATURE: u32 = 0x07;
+
+    fn hidioc(nr: u32, len: usize) -> u32 {
+        IOC_RW | ((len as u32) << 16) | ((b'H' as u32) << 8) | nr
+    }
+
+    /// udev sends the events it has processed to this netlink group, the
+    /// device node exists and has its permissions then
+    const UDEV_GROUP: u32 = 2;
+
+    /// A hidraw node, written without hidapi
+    pub struct Hidraw {
+        file: File,
+    }
+
+    impl Hidraw {
+        fn feature(&self, nr: u32, buf: *mut u8, len: usize) -> io::Result<usize> {
+            let ret = unsafe { libc::ioctl(self.file.as_raw_fd(), hidioc(nr, len) as _, buf) };
+
+            if ret < 0 {
+                Err(io::Error::last_os_error())
+            } else {
+                Ok(ret as usize)
+            }
+        }
+    }
+
+    impl Device for Hidraw {
+        fn write(&self, buf: &[u8]) -> io::Result<usize> {
+            (&self.file).write(buf)
+        }
+
+        fn send_feature_report(&self, buf: &[u8]) -> io::Result<()> {
+            self.feature(HIDIOCSFEATURE, buf.as_ptr() as *mut u8, buf.len())
+                .map(|_| ())
+        }
+
+        fn get_feature_report(&self, buf: &mut [u8]) -> io::Result<usize> {
+            self.feature(HIDIOCGFEATURE, buf.as_mut_ptr(), buf.len())
+        }
+    }
+
+    pub struct Transport {
+        /// as in HID_ID of the uevent, e.g. "00002E8A:0000C011"
+        id: String,
+        monitor: Option<OwnedFd>,
+    }
+
+    impl Transport {
+        /// Without udev there are no hotplug events, the device is only
+        /// found when `open` is tried again
+        pub fn new(vid: u16, pid: u16) -> io::Result<Self> {
+            let monitor = Self::monitor()
+                .map_err(|e| eprintln!("No hotplug events: {}", e))
+                .ok();
+
+            Ok(Transport {
+                id: format!("{:08X}:{:08X}", vid, pid),
+                monitor,
+            })
+        }
+
+        fn monitor() -> io::Result<OwnedFd> {
+            let fd = unsafe {
+                libc::socket(
+                    libc::AF_NETLINK,
+                    libc::SOCK_DGRAM | libc::SOCK_CLOEXEC | libc::SOCK_NONBLOCK,
+                    libc::NETLINK_KOBJECT_UEVENT,
+                )
+            };
+            if fd < 0 {
+                return Err(io::Error::last_os_error());
+            }
+            let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+            let mut addr: libc::sockaddr_nl = unsafe { std::mem::zeroed() };
+            addr.nl_family = libc::AF_NETLINK as libc::sa_family_t;
+            addr.nl_groups = UDEV_GROUP;
+            if unsafe {
+                libc::bind(
+                    fd.as_raw_fd(),
+                    (&addr as *const libc::sockaddr_nl).cast(),
+                    size_of::<libc::sockaddr_nl>() as libc::socklen_t,
+                )
+            } < 0
+            {
+                return Err(io::Error::last_os_error());
+            }
+            Ok(fd)
+        }
+
+        /// The hidraw node of the device, from /sys/class/hidraw
+        fn find(&self) -> io::Result<PathBuf> {
+            for entry in fs::read_dir("/sys/class/hidraw")? {
+                let entry = entry?;
+                let uevent = match fs::read_to_string(entry.path().join("device/uevent")) {
+                    Ok(uevent) => uevent,
+                    Err(_) => continue,
+                };
+                // HID_ID=<bus>:<vid>:<pid>
+                if uevent
+                    .lines()
+                    .filter_map(|l| l.strip_prefix("HID_ID="))
+                    .any(|id| id.get(5..) == Some(self.id.as_str()))
+                {
+                    return Ok(PathBuf::from("/dev").join(entry.file_name()));
+                }
+            }
+            Err(io::Error::new(
+                io::ErrorKind::NotFound,
+                "no pcmeter-pico found",
+            ))
+        }
+
+        /// The node is opened O_NONBLOCK, so a driver that can not take a
+        /// report returns EAGAIN instead of holding up the tick. Its EPOLLOUT
+        /// is not watched: hidraw always polls writable, and a report that
+        /// waited for the device would be older than the one of the next tick.
+        pub fn open(&mut self) -> io::Result<Hidraw> {
+            let path = self.find()?;
+
+            Ok(Hidraw {
+                file: OpenOptions::new()
+                    .read(true)
+                    .write(true)
+                    .custom_flags(libc::O_NONBLOCK)
+                    .open(path)?,
+            })
+        }
+
+        /// Readable when udev has events, see `hotplugged`
+        pub fn hotplug_fd(&self) -> Option<RawFd> {
+            self.monitor.as_ref().map(|fd| fd.as_raw_fd())
+        }
+
+        /// Reads all pending udev events, true if a hidraw node was added.
+        /// Whether it is the pcmeter-pico `open` finds out.
+        pub fn hotplugged(&mut self) -> bool {
+            let mut buf = [0u8; 8192];
+            let mut added = false;
+            let fd = match &self.monitor {
+                Some(fd) => fd.as_raw_fd(),
+                None => return false,
+            };
+
+            loop {
+                let n = unsafe { libc::recv(fd, buf.as_mut_ptr().cast(), buf.len(), 0) };
+                if n <= 0 {
+                    return added;
+                }
+                // "KEY=value" strings behind a header, each ends with a NUL
+                let mut action = false;
+                let mut hidraw = false;
+                for prop in buf[..n as usize].split(|&b| b == 0) {
+                    action |= prop == b"ACTION=add";
+                    hidraw |= prop == b"SUBSYSTEM=hidraw";
+                }
+                added |= action && hidraw;
+            }
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod imp {
+    use super::Device;
+    use hidapi::{HidApi, HidDevice};
+    use std::io;
+
+    impl Device for HidDevice {
+        fn write(&self, buf: &[u8]) -> io::Result<usize> {
+            HidDevice::write(self, buf).map_err(io::Error::other)
+        }
+
+        fn send_feature_report(&self, buf: &[u8]) -> io::Result<()> {
+            HidDevice::send_feature_report(self, buf).map_err(io::Error::other)
+        }
+
+        fn get_feature_report(&self, buf: &mut [u8]) -> io::Result<usize> {
+            HidDevice::get_feature_report(self, buf).map_err(io::Error::other)
+        }
+    }
+
+    /// hidapi, without hotplug events
+    pub struct Transport {
+        api: HidApi,
+        vid: u16,
+        pid: u16,
+    }
+
+    impl Transport {
+        pub fn new(vid: u16, pid: u16) -> io::Result<Self> {
+            Ok(Transport {
+                api: HidApi::new().map_err(io::Error::other)?,
+                vid,
+                pid,
+            })
+        }
+
+        pub fn open(&mut self) -> io::Result<HidDevice> {
+            self.api.open(self.vid, self.pid).map_err(io::Error::other)
+        }
+
+        pub fn hotplugged(&mut self) -> bool {
+            false
+        }
+    }
+}
+
+pub use imp::Transport;
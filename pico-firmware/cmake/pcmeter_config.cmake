@@ -0,0 +1,128 @@
+# Turns the declarative meter configuration (meters_config.cmake) into the
+# constant tables in meters_config.h, so the firmware needs no runtime parsing.
+
+set(PCMETER_CONFIG_DIR ${CMAKE_CURRENT_LIST_DIR})
+set(PCMETER_METERS "")
+set(PCMETER_WS2812_PINS 2)
+set(PCMETER_WS2812_IS_RGBW false)
+set(PCMETER_WS2812_LENGTHS "")
+# report ids the firmware can map, MAPPING_REPORTS in src/mapping.h
+set(PCMETER_MAPPING_REPORTS 4)
+# pins of the RP2040, GPIO 0-29
+set(PCMETER_PIN_MAX 29)
+
+# pcmeter_meter(<NAME> PIN <pin> MAX <0-255>
+#               LED_STRIP <strip> LED_FIRST <first led> LED_COUNT <count>
+#               REPORT <report id> BYTE <byte> [SCALE <percent>]
+#               [FILTER <NONE|EMA|SPRING|SLEW>] [FILTER_TIME <ms>])
+function(pcmeter_meter name)
+        cmake_parse_arguments(M "" "PIN;MAX;LED_STRIP;LED_FIRST;LED_COUNT;REPORT;BYTE;SCALE;FILTER;FILTER_TIME" "" ${ARGN})
+        foreach(key PIN MAX LED_STRIP LED_FIRST LED_COUNT REPORT BYTE)
+                if (NOT DEFINED M_${key})
+                        message(FATAL_ERROR "pcmeter_meter(${name}): ${key} is missing")
+                endif()
+        endforeach()
+        if (NOT DEFINED M_SCALE)
+                set(M_SCALE 100)
+        endif()
+        if (NOT DEFINED M_FILTER)
+                set(M_FILTER SPRING)
+        endif()
+        if (NOT DEFINED M_FILTER_TIME)
+                set(M_FILTER_TIME 150)
+        endif()
+        if (M_PIN LESS 0 OR M_PIN GREATER PCMETER_PIN_MAX)
+                message(FATAL_ERROR "pcmeter_meter(${name}): PIN must be 0-${PCMETER_PIN_MAX}")
+        endif()
+        if (M_MAX GREATER 255)
+                message(FATAL_ERROR "pcmeter_meter(${name}): MAX must be 0-255")
+        endif()
+        if (M_REPORT LESS 0 OR NOT M_REPORT LESS PCMETER_MAPPING_REPORTS)
+                math(EXPR last "${PCMETER_MAPPING_REPORTS} - 1")
+                message(FATAL_ERROR "pcmeter_meter(${name}): REPORT must be 0-${last}")
+        endif()
+        if (M_BYTE LESS 1 OR M_BYTE GREATER 63)
+                message(FATAL_ERROR "pcmeter_meter(${name}): BYTE must be 1-63")
+        endif()
+        if (NOT M_SCALE GREATER 0 OR M_SCALE GREATER 65535)
+                message(FATAL_ERROR "pcmeter_meter(${name}): SCALE must be 1-65535 percent")
+        endif()
+        if (NOT M_FILTER MATCHES "^(NONE|EMA|SPRING|SLEW)$")
+                message(FATAL_ERROR "pcmeter_meter(${name}): FILTER must be NONE, EMA, SPRING or SLEW")
+        endif()
+        if (M_FILTER_TIME GREATER 65535)
+                message(FATAL_ERROR "pcmeter_meter(${name}): FILTER_TIME must be 0-65535 ms")
+        endif()
+        if (name IN_LIST PCMETER_METERS)
+                message(FATAL_ERROR "pcmeter_meter(${name}): meter defined twice")
+        endif()
+        foreach(key PIN MAX LED_STRIP LED_FIRST LED_COUNT REPORT BYTE SCALE FILTER FILTER_TIME)
+                set(PCMETER_METER_${name}_${key} ${M_${key}} PARENT_SCOPE)
+        endforeach()
+        set(PCMETER_METERS ${PCMETER_METERS} ${name} PARENT_SCOPE)
+endfunction()
+
+# Write the header with the tables to <output>
+function(pcmeter_generate_config config output)
+        include(${config})
+        if (NOT PCMETER_METERS)
+                message(FATAL_ERROR "${config}: no meters defined")
+        endif()
+        list(LENGTH PCMETER_WS2812_PINS PCMETER_WS2812_STRIPS)
+        if (PCMETER_WS2812_STRIPS GREATER 8)
+                message(FATAL_ERROR "${config}: at most 8 WS2812 strips")
+        endif()
+        foreach(pin ${PCMETER_WS2812_PINS})
+                if (pin LESS 0 OR pin GREATER PCMETER_PIN_MAX)
+                        message(FATAL_ERROR "${config}: WS2812 pin ${pin} must be 0-${PCMETER_PIN_MAX}")
+                endif()
+        endforeach()
+        # without PCMETER_WS2812_LENGTHS a strip is as long as its meters need
+        if (NOT PCMETER_WS2812_LENGTHS)
+                string(REPEAT "0;" ${PCMETER_WS2812_STRIPS} PCMETER_WS2812_LENGTHS)
+                list(REMOVE_AT PCMETER_WS2812_LENGTHS -1)
+        endif()
+        list(LENGTH PCMETER_WS2812_LENGTHS lengths)
+        if (NOT lengths EQUAL PCMETER_WS2812_STRIPS)
+                message(FATAL_ERROR "${config}: PCMETER_WS2812_LENGTHS needs one length per pin of PCMETER_WS2812_PINS")
+        endif()
+
+        set(PCMETER_METER_ENUM "")
+        set(PCMETER_METER_DEFINES "")
+        set(PCMETER_METER_TABLE "")
+        set(idx 0)
+        foreach(name ${PCMETER_METERS})
+                if (PCMETER_METER_${name}_LED_STRIP GREATER_EQUAL PCMETER_WS2812_STRIPS)
+                        message(FATAL_ERROR "pcmeter_meter(${name}): LED_STRIP ${PCMETER_METER_${name}_LED_STRIP} does not exist")
+                endif()
+                list(GET PCMETER_WS2812_LENGTHS ${PCMETER_METER_${name}_LED_STRIP} length)
+                if (length EQUAL 0)
+                        set(length 65535)
+                endif()
+                math(EXPR last "${PCMETER_METER_${name}_LED_FIRST} + ${PCMETER_METER_${name}_LED_COUNT}")
+                if (last GREATER length)
+                        message(FATAL_ERROR "pcmeter_meter(${name}): LED_FIRST + LED_COUNT is ${last}, strip ${PCMETER_METER_${name}_LED_STRIP} has ${length} LEDs")
+                endif()
+                string(APPEND PCMETER_METER_ENUM "    ${name} = ${idx},\n")
+                string(APPEND PCMETER_METER_DEFINES "#define HAVE_METER_${name} 1\n")
+                string(APPEND PCMETER_METER_TABLE
+                        "    [${name}] = {\n"
+                        "        .pin = ${PCMETER_METER_${name}_PIN},\n"
+                        "        .max = ${PCMETER_METER_${name}_MAX},\n"
+                        "        .led_strip = ${PCMETER_METER_${name}_LED_STRIP},\n"
+                        "        .led_first = ${PCMETER_METER_${name}_LED_FIRST},\n"
+                        "        .led_count = ${PCMETER_METER_${name}_LED_COUNT},\n"
+                        "        .report_id = ${PCMETER_METER_${name}_REPORT},\n"
+                        "        .report_byte = ${PCMETER_METER_${name}_BYTE},\n"
+                        "        .scale = ${PCMETER_METER_${name}_SCALE},\n"
+                        "        .filter = FILTER_${PCMETER_METER_${name}_FILTER},\n"
+                        "        .filter_time = ${PCMETER_METER_${name}_FILTER_TIME},\n"
+                        "    },\n")
+                math(EXPR idx "${idx} + 1")
+        endforeach()
+        string(REPLACE ";" ", " PCMETER_WS2812_PIN_LIST "${PCMETER_WS2812_PINS}")
+        string(REPLACE ";" ", " PCMETER_WS2812_LENGTH_LIST "${PCMETER_WS2812_LENGTHS}")
+
+        configure_file(${PCMETER_CONFIG_DIR}/meters_config.h.in ${output} @ONLY)
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${config})
+endfunction()
@@ -0,0 +1,23 @@
+# Meter configuration of the pcmeter-pico.
+# This file is read by CMake and turned into the tables in meters_config.h,
+# see "Additional meters" in the Readme.
+
+# Pins of the WS2812 LED strips, all strips are sent out in parallel
+set(PCMETER_WS2812_PINS 2)
+set(PCMETER_WS2812_IS_RGBW false)
+# LEDs on each strip, optional, by default a strip is as long as its meters need
+#set(PCMETER_WS2812_LENGTHS 8)
+
+# MAX: set this value to correct cheap meters that display wrong,
+# also if you have 3V meters tune this down so it shows 3V at 100%
+pcmeter_meter(CPU
+        PIN 3 MAX 228
+        LED_STRIP 0 LED_FIRST 0 LED_COUNT 4
+        REPORT 0 BYTE 2 SCALE 100
+        FILTER SPRING FILTER_TIME 150)
+
+pcmeter_meter(MEM
+        PIN 4 MAX 228
+        LED_STRIP 0 LED_FIRST 4 LED_COUNT 4
+        REPORT 0 BYTE 3 SCALE 100
+        FILTER SPRING FILTER_TIME 150)
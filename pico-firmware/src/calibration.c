@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include <string.h>
+#include "calibration.h"
+
+void calibration_linear(struct cal_curve *c, uint16_t max) {
+    memset(c, 0, sizeof(*c));
+    c->version = CAL_VERSION;
+    c->count = 2;
+    c->points[0].in = 0;
+    c->points[0].out = 0;
+    c->points[1].in = 100;
+    c->points[1].out = max;
+}
+
+bool calibration_valid(const struct cal_curve *c) {
+    if (c->version != CAL_VERSION || c->count < 2 || c->count > CAL_POINTS)
+        return false;
+    for (uint8_t i = 0; i < c->count; i++) {
+        if (c->points[i].in > 100)
+            return false;
+        if (i > 0 && c->points[i].in <= c->points[i - 1].in)
+            return false;
+    }
+    return true;
+}
+
+void calibration_lut(const struct cal_curve *c, uint16_t lut[CAL_LUT_SIZE]) {
+    uint8_t seg = 0;
+
+    for (int in = 0; in < CAL_LUT_SIZE; in++) {
+        const struct cal_point *a, *b;
+
+        while (seg + 2 < c->count && in > c->points[seg + 1].in)
+            seg++;
+        a = &c->points[seg];
+        b = &c->points[seg + 1];
+
+        if (in <= a->in)
+            lut[in] = a->out;
+        else if (in >= b->in)
+            lut[in] = b->out;
+        else
+            lut[in] = a->out + ((int32_t)b->out - a->out) * (in - a->in) / (b->in - a->in);
+    }
+}
+
+uint16_t calibration_lookup(const uint16_t lut[CAL_LUT_SIZE], uint16_t value) {
+    /* position in the table as 16.16, adding pos >> 16 lets 65535 reach the end */
+    uint32_t pos = (uint32_t)value * (CAL_LUT_SIZE - 1);
+    uint32_t idx, frac;
+
+    pos += pos >> 16;
+    idx = pos >> 16;
+    frac = (pos & 0xffff) >> 1;
+    if (idx >= CAL_LUT_SIZE - 1)
+        return lut[CAL_LUT_SIZE - 1];
+    return lut[idx] + ((int32_t)lut[idx + 1] - lut[idx]) * (int32_t)frac / 32768;
+}
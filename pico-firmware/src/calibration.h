@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Calibration of a meter as a piecewise linear transfer curve.
+ * Each point maps an input in percent to an output level, where 65535 is
+ * the full 3.3V. Between the points the output is interpolated linearly,
+ * below the first and above the last point it is held.
+ * The curve is turned into a lookup table once, showing a value only
+ * interpolates between two neighbouring entries.
+ * No pico-sdk in here, this builds for the host as well.
+ */
+
+#define CAL_POINTS 8
+#define CAL_LUT_SIZE 101    /* one entry for every percent 0-100 */
+#define CAL_VERSION 1       /* bump when struct cal_curve changes */
+
+struct cal_point {
+    uint16_t out;
+    uint8_t in;
+    uint8_t reserved;
+};
+
+struct cal_curve {
+    uint8_t version;
+    uint8_t count;
+    struct cal_point points[CAL_POINTS];
+};
+
+/* straight line from 0 to max, what a meter without calibration does */
+void calibration_linear(struct cal_curve *c, uint16_t max);
+/* at least 2 points, inputs rising and at most 100 */
+bool calibration_valid(const struct cal_curve *c);
+void calibration_lut(const struct cal_curve *c, uint16_t lut[CAL_LUT_SIZE]);
+/* output for value, where 65535 is 100% */
+uint16_t calibration_lookup(const uint16_t lut[CAL_LUT_SIZE], uint16_t value);
+
+#endif // CALIBRATION_H_
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include <string.h>
+#include "feature.h"
+#include "mapping.h"
+#include "calibration.h"
+#include "report.h"
+#include "meters.h"
+
+static uint8_t response[FEATURE_REPORT_SIZE];
+
+static void put_le16(uint8_t *p, int16_t v) {
+    p[0] = (uint16_t)v & 0xff;
+    p[1] = (uint16_t)v >> 8;
+}
+
+static int16_t get_le16(uint8_t const *p) {
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static uint8_t feature_info(void) {
+    bool mapping;
+    uint8_t calibration;
+    bool ok = meters_getSaveState(&mapping, &calibration);
+
+    response[2] = FEATURE_VERSION;
+    response[3] = NUMBER_OF_METERS;
+    response[4] = MAPPING_REPORTS;
+    response[5] = mapping;
+    response[6] = calibration;
+    return ok ? FEATURE_OK : FEATURE_ERR_FLASH;
+}
+
+/* pcmeter_protocol.h counts like the PC side, here byte 0 is the command */
+static void feature_caps(void) {
+    const struct report_stats *s = meters_getReportStats();
+
+    response[PCM_CAPS_OFF_CAPS - 1] = PCM_CAP_LEGACY | PCM_CAP_V2 | PCM_CAP_CORES;
+    response[PCM_CAPS_OFF_VERSION - 1] = PCM_V2_VERSION;
+    response[PCM_CAPS_OFF_SIZE - 1] = PCM_REPORT_SIZE;
+    pcm_put_le32(&response[PCM_CAPS_OFF_FRAMES - 1], s->frames);
+    pcm_put_le32(&response[PCM_CAPS_OFF_LOST - 1], s->lost);
+    pcm_put_le32(&response[PCM_CAPS_OFF_REORDERED - 1], s->reordered);
+    pcm_put_le16(&response[PCM_CAPS_OFF_CORES - 1], s->cores.count);
+    pcm_put_le32(&response[PCM_CAPS_OFF_CORES_DROPPED - 1], s->cores.dropped);
+}
+
+static uint8_t feature_map_set(uint8_t const* buffer, uint16_t bufsize) {
+    struct mapping_binding b;
+
+    if (bufsize < 10)
+        return FEATURE_ERR_ARG;
+    b.report_id = buffer[2];
+    b.byte = buffer[3];
+    b.scale = get_le16(&buffer[4]);
+    b.offset = get_le16(&buffer[6]);
+    b.min = buffer[8];
+    b.max = buffer[9];
+    if (!mapping_set(meters_getMapping(), buffer[1], &b))
+        return FEATURE_ERR_ARG;
+    return FEATURE_OK;
+}
+
+static uint8_t feature_map_get(uint8_t const* buffer, uint16_t bufsize) {
+    const struct mapping_binding *b;
+
+    if (bufsize < 2)
+        return FEATURE_ERR_ARG;
+    b = mapping_get(meters_getMapping(), buffer[1]);
+    if (!b)
+        return FEATURE_ERR_ARG;
+    response[2] = buffer[1];
+    response[3] = b->report_id;
+    response[4] = b->byte;
+    put_le16(&response[5], b->scale);
+    put_le16(&response[7], b->offset);
+    response[9] = b->min;
+    response[10] = b->max;
+    return FEATURE_OK;
+}
+
+static uint8_t feature_cal_set(uint8_t const* buffer, uint16_t bufsize) {
+    struct cal_curve c;
+    uint8_t count;
+
+    if (bufsize < 3)
+        return FEATURE_ERR_ARG;
+    count = buffer[2];
+    if (count > CAL_POINTS || 3 + count * 3 > bufsize)
+        return FEATURE_ERR_ARG;
+
+    memset(&c, 0, sizeof(c));
+    c.version = CAL_VERSION;
+    c.count = count;
+    for (uint8_t i = 0; i < count; i++) {
+        c.points[i].in = buffer[3 + i * 3];
+        c.points[i].out = (uint16_t)get_le16(&buffer[4 + i * 3]);
+    }
+    if (!meters_setCalibration(buffer[1], &c))
+        return FEATURE_ERR_ARG;
+    return FEATURE_OK;
+}
+
+static uint8_t feature_cal_get(uint8_t const* buffer, uint16_t bufsize) {
+    const struct cal_curve *c;
+
+    if (bufsize < 2)
+        return FEATURE_ERR_ARG;
+    c = meters_getCalibration(buffer[1]);
+    if (!c)
+        return FEATURE_ERR_ARG;
+    response[2] = buffer[1];
+    response[3] = c->count;
+    for (uint8_t i = 0; i < c->count; i++) {
+        response[4 + i * 3] = c->points[i].in;
+        put_le16(&response[5 + i * 3], c->points[i].out);
+    }
+    return FEATURE_OK;
+}
+
+void feature_set(uint8_t const* buffer, uint16_t bufsize) {
+    uint8_t status = FEATURE_OK;
+
+    if (bufsize < 1)
+        return;
+    memset(response, 0, sizeof(response));
+    response[0] = buffer[0];
+
+    switch (buffer[0]) {
+    case FEATURE_CMD_INFO:
+        status = feature_info();
+        break;
+    case FEATURE_CMD_CAPS:
+        feature_caps();
+        break;
+    case FEATURE_CMD_MAP_SET:
+        status = feature_map_set(buffer, bufsize);
+        break;
+    case FEATURE_CMD_MAP_GET:
+        status = feature_map_get(buffer, bufsize);
+        break;
+    case FEATURE_CMD_MAP_SAVE:
+        /* flash is written later from the scheduler, not inside the USB callback */
+        meters_saveMapping();
+        break;
+    case FEATURE_CMD_MAP_RESET:
+        meters_defaultMapping();
+        break;
+    case FEATURE_CMD_CAL_SET:
+        status = feature_cal_set(buffer, bufsize);
+        break;
+    case FEATURE_CMD_CAL_GET:
+        status = feature_cal_get(buffer, bufsize);
+        break;
+    case FEATURE_CMD_CAL_SAVE:
+        if (bufsize < 2 || !meters_getCalibration(buffer[1]))
+            status = FEATURE_ERR_ARG;
+        else
+            meters_saveCalibration(buffer[1]);
+        break;
+    case FEATURE_CMD_CAL_RESET:
+        if (bufsize < 2 || !meters_getCalibration(buffer[1]))
+            status = FEATURE_ERR_ARG;
+        else
+            meters_defaultCalibration(buffer[1]);
+        break;
+    default:
+        status = FEATURE_ERR_CMD;
+        break;
+    }
+    response[1] = status;
+}
+
+uint16_t feature_get(uint8_t* buffer, uint16_t reqlen) {
+    uint16_t len = reqlen < sizeof(response) ? reqlen : sizeof(response);
+
+    /* nothing was asked yet, tell what we are */
+    if (response[0] == 0) {
+        response[0] = FEATURE_CMD_INFO;
+        response[1] = feature_info();
+    }
+    memcpy(buffer, response, len);
+    return len;
+}
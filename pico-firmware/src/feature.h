@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef FEATURE_H_
+#define FEATURE_H_
+
+#include <stdint.h>
+#include "pcmeter_protocol.h"
+
+/*
+ * Configuration of the device through HID feature reports.
+ * The host sends a command with SET_REPORT (feature), the answer to the last
+ * command is read back with GET_REPORT (feature).
+ * Byte 0 of a feature report is the command, multi byte values are little endian.
+ *
+ * FEATURE_CMD_INFO      -> [2] feature protocol version, [3] number of meter slots,
+ *                          [4] number of mappable reports, [5] 1 while the mapping
+ *                          is not saved yet, [6] calibrations not saved yet, bit
+ *                          per meter. Status FEATURE_ERR_FLASH if the last save
+ *                          failed, it stays pending until the next MAP_SAVE or
+ *                          CAL_SAVE tries again.
+ * FEATURE_CMD_CAPS      -> report protocols understood and report counters,
+ *                          see pcmeter_protocol.h
+ * FEATURE_CMD_MAP_SET   [1] slot, [2] report id, [3] byte, [4-5] scale Q8.8,
+ *                       [6-7] offset percent Q8.8, [8] min %, [9] max %
+ * FEATURE_CMD_MAP_GET   [1] slot -> [2] slot, [3-10] like bytes [2-9] of MAP_SET
+ * FEATURE_CMD_MAP_SAVE  store the mapping in flash
+ * FEATURE_CMD_MAP_RESET back to the mapping from meters_config.cmake (not saved)
+ * FEATURE_CMD_CAL_SET   [1] meter, [2] number of points (2-8), then per point
+ *                       [0] input percent, [1-2] output, 65535 is 3.3V
+ * FEATURE_CMD_CAL_GET   [1] meter -> [2] meter, [3...] like bytes [2...] of CAL_SET
+ * FEATURE_CMD_CAL_SAVE  [1] meter, store its calibration in flash
+ * FEATURE_CMD_CAL_RESET [1] meter, back to a straight line up to MAX (not saved)
+ *
+ * Every answer starts with [0] command, [1] status.
+ */
+
+#define FEATURE_VERSION 1
+#define FEATURE_REPORT_SIZE 64
+
+enum {
+    FEATURE_CMD_INFO = 0x01,
+    FEATURE_CMD_CAPS = PCM_FEATURE_CMD_CAPS,
+    FEATURE_CMD_MAP_SET = 0x10,
+    FEATURE_CMD_MAP_GET = 0x11,
+    FEATURE_CMD_MAP_SAVE = 0x12,
+    FEATURE_CMD_MAP_RESET = 0x13,
+    FEATURE_CMD_CAL_SET = 0x20,
+    FEATURE_CMD_CAL_GET = 0x21,
+    FEATURE_CMD_CAL_SAVE = 0x22,
+    FEATURE_CMD_CAL_RESET = 0x23,
+};
+
+enum {
+    FEATURE_OK = 0,
+    FEATURE_ERR_CMD = 1,    /* unknown command */
+    FEATURE_ERR_ARG = 2,    /* invalid slot or binding */
+    FEATURE_ERR_FLASH = 3,  /* a save could not be written to flash */
+};
+
+/* handle a SET_REPORT of type feature */
+void feature_set(uint8_t const* buffer, uint16_t bufsize);
+/* fill in a GET_REPORT of type feature, returns its length */
+uint16_t feature_get(uint8_t* buffer, uint16_t reqlen);
+
+#endif // FEATURE_H_
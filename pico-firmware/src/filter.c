@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include "filter.h"
+
+#define POS_MAX ((int32_t)FILTER_MAX << 8)
+/* coefficients are Q24, at a 1 ms tick Q16 would lose most of a slow spring */
+#define K_SHIFT 24
+#define K_MASK ((1 << K_SHIFT) - 1)
+
+void filter_init(struct filter *f, uint8_t type, uint16_t time_ms, uint16_t dt_ms) {
+    f->type = type;
+    f->k1 = 0;
+    f->k2 = 0;
+    f->pos = 0;
+    f->vel = 0;
+    f->rest = 0;
+    if (dt_ms == 0)
+        dt_ms = 1;
+
+    switch (type) {
+    case FILTER_EMA:
+        /* alpha = dt / (time + dt) */
+        f->k1 = (int32_t)(((int64_t)dt_ms << K_SHIFT) / ((int32_t)time_ms + dt_ms));
+        break;
+    case FILTER_SPRING:
+        /* with w*dt above 1/2 the discrete spring starts to ring */
+        if (time_ms < 2 * dt_ms)
+            time_ms = 2 * dt_ms;
+        /* k1 = (w*dt)^2 and k2 = 2*w*dt, with w = 1 / time */
+        f->k1 = (int32_t)(((int64_t)dt_ms * dt_ms << K_SHIFT) / ((int64_t)time_ms * time_ms));
+        f->k2 = (int32_t)(((int64_t)dt_ms << (K_SHIFT + 1)) / time_ms);
+        break;
+    case FILTER_SLEW:
+        /* largest step per tick */
+        f->k1 = time_ms <= dt_ms ? POS_MAX : (int32_t)((int64_t)POS_MAX * dt_ms / time_ms);
+        break;
+    default:
+        f->type = FILTER_NONE;
+        break;
+    }
+}
+
+void filter_reset(struct filter *f, uint16_t value) {
+    f->pos = (int32_t)value << 8;
+    f->vel = 0;
+    f->rest = 0;
+}
+
+uint16_t filter_step(struct filter *f, uint16_t target) {
+    int32_t t = (int32_t)target << 8;
+    int32_t d = t - f->pos;
+    int64_t acc;
+
+    switch (f->type) {
+    case FILTER_EMA:
+        /* keeping the rest avoids a dead band close to the target */
+        acc = (int64_t)d * f->k1 + f->rest;
+        f->pos += (int32_t)(acc >> K_SHIFT);
+        f->rest = acc & K_MASK;
+        break;
+    case FILTER_SPRING:
+        /* semi-implicit Euler: the velocity first, then the position with it */
+        acc = (int64_t)d * f->k1 - (int64_t)f->vel * f->k2 + f->rest;
+        f->vel += (int32_t)(acc >> K_SHIFT);
+        f->rest = acc & K_MASK;
+        f->pos += f->vel;
+        break;
+    case FILTER_SLEW:
+        if (d > f->k1)
+            d = f->k1;
+        else if (d < -f->k1)
+            d = -f->k1;
+        f->pos += d;
+        break;
+    default:
+        f->pos = t;
+        break;
+    }
+
+    /* the needle stops at the ends of the scale */
+    if (f->pos < 0) {
+        f->pos = 0;
+        f->vel = 0;
+    } else if (f->pos > POS_MAX) {
+        f->pos = POS_MAX;
+        f->vel = 0;
+    }
+    return (f->pos + 128) >> 8;
+}
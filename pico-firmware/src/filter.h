@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Smoothing of the needle movement in fixed point.
+ * Values are 0-65535 for 0-100%, internally they carry 8 more bits so small
+ * steps do not get stuck. Every filter is stepped once per tick of dt ms.
+ * FILTER_EMA     exponential moving average, time is the time constant
+ * FILTER_SPRING  critically damped spring, follows like a real needle without
+ *                overshooting, time is the response time (1/omega)
+ * FILTER_SLEW    moves at constant speed, time is for going 0-100%
+ * No pico-sdk in here, this builds for the host as well.
+ */
+
+#define FILTER_MAX 65535
+
+enum filter_type {
+    FILTER_NONE = 0,
+    FILTER_EMA,
+    FILTER_SPRING,
+    FILTER_SLEW,
+};
+
+struct filter {
+    uint8_t type;
+    int32_t k1;     /* coefficients, depend on type, time and dt */
+    int32_t k2;
+    int32_t pos;    /* Q8 on top of 0-65535 */
+    int32_t vel;    /* per tick, Q8, only used by the spring */
+    int32_t rest;   /* bits shifted out last step, carried into the next */
+};
+
+void filter_init(struct filter *f, uint8_t type, uint16_t time_ms, uint16_t dt_ms);
+/* jump to value without any movement */
+void filter_reset(struct filter *f, uint16_t value);
+/* advance one tick towards target and return the new value */
+uint16_t filter_step(struct filter *f, uint16_t target);
+
+#endif // FILTER_H_
@@ -32,9 +32,13 @@
 #include <stdio.h>
 
 #include "pico/stdlib.h"
+#include "pico/time.h"
 #include "bsp/board.h"
 #include "tusb.h"
 #include "meters.h"
+#include "sched.h"
+#include "feature.h"
+#include "pcmeter_protocol.h"
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
@@ -53,6 +57,10 @@ enum  {
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 void led_blinking_task(void);
+static void set_blink_interval(uint32_t interval_ms);
+
+static struct sched main_sched;
+static int8_t blink_task = -1;
 
 /*------------- MAIN -------------*/
 int main(void) {
@@ -61,14 +69,20 @@ int main(void) {
   tusb_init();
   meters_setup();
 
+  sched_init(&main_sched, board_millis);
+  blink_task = sched_add(&main_sched, led_blinking_task, blink_interval_ms);
+  meters_registerTasks(&main_sched);
+
   while (1) {
     tud_task(); // tinyusb device task
-    led_blinking_task();
-
-    meters_receiveSerialData();
-    meters_updateStats();
-    meters_updateMeters();
-    meters_screenSaver();
+    if (tud_cdc_n_available(0))
+      meters_serialAvailable();
+    uint32_t idle_ms = sched_run(&main_sched);
+
+    /* Sleep until the next deadline. Any interrupt (e.g. USB) wakes us early,
+     * so an event that arrives between the check and the wfe is not lost. */
+    if (idle_ms && !tud_task_event_ready())
+      best_effort_wfe_or_timeout(make_timeout_time_ms(idle_ms));
   }
 }
 
@@ -79,13 +93,13 @@ int main(void) {
 // Invoked when device is mounted
 void tud_mount_cb(void)
 {
-  blink_interval_ms = BLINK_MOUNTED;
+  set_blink_interval(BLINK_MOUNTED);
 }
 
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
-  blink_interval_ms = BLINK_NOT_MOUNTED;
+  set_blink_interval(BLINK_NOT_MOUNTED);
 }
 
 // Invoked when usb bus is suspended
@@ -94,13 +108,13 @@ void tud_umount_cb(void)
 void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void) remote_wakeup_en;
-  blink_interval_ms = BLINK_SUSPENDED;
+  set_blink_interval(BLINK_SUSPENDED);
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
-  blink_interval_ms = tud_mounted() ? BLINK_MOUNTED : BLINK_NOT_MOUNTED;
+  set_blink_interval(tud_mounted() ? BLINK_MOUNTED : BLINK_NOT_MOUNTED);
 }
 
 //--------------------------------------------------------------------+
@@ -112,38 +126,41 @@ void tud_resume_cb(void)
 // Return zero will cause the stack to STALL request
 uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
-  // TODO not Implemented
   (void) itf;
   (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
+
+  // feature reports configure the device, see feature.h
+  if (report_type == HID_REPORT_TYPE_FEATURE)
+    return feature_get(buffer, reqlen);
 
   return 0;
 }
 
-#define SYSTEM_REPORT 0
-#define USER_REPORT 1
+#define SYSTEM_REPORT PCM_REPORT_SYSTEM
+#define USER_REPORT PCM_REPORT_USER
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
   // This example doesn't use multiple report and report ID
   (void) itf;
-  (void) report_type;
+  (void) report_id;
+
+  if (report_type == HID_REPORT_TYPE_FEATURE) {
+    feature_set(buffer, bufsize);
+    return;
+  }
+
   /* NOTE: be aware that tinyusb cuts off the report ID
    * for us in this function.
    * So buffer[1] on PC side becomes buffer[0] here
    */
+  /* which byte goes to which meter is set in meters_config.cmake
+   * and can be changed with feature reports */
+  meters_handleReport(buffer, bufsize);
+
   switch (buffer[0]) {
     case SYSTEM_REPORT:
-      for (int i = 0; i < NUMBER_OF_METERS; i++) {
-        if (buffer[i+1] > 0) {
-          updateLastValueReceived(i, MIN(buffer[i+1], 100));
-          /* NOTE more to come here ... */
-        }
-      }
-      updateLastTimeReceived();
 #ifdef DEBUG
       printf("HID got system report:\n");
       for (uint8_t i = 0; i < bufsize; i+=16) {
@@ -171,15 +188,17 @@ void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t rep
 //--------------------------------------------------------------------+
 // BLINKING TASK
 //--------------------------------------------------------------------+
+static void set_blink_interval(uint32_t interval_ms)
+{
+  blink_interval_ms = interval_ms;
+  sched_set_period(&main_sched, blink_task, interval_ms);
+}
+
+// Runs every blink_interval_ms
 void led_blinking_task(void)
 {
-  static uint32_t start_ms = 0;
   static bool led_state = false;
 
-  // Blink every interval ms
-  if ( board_millis() - start_ms < blink_interval_ms) return; // not enough time
-  start_ms += blink_interval_ms;
-
   board_led_write(led_state);
   led_state = 1 - led_state; // toggle
 }
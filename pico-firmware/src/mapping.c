@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include <string.h>
+#include "mapping.h"
+
+static bool mapping_valid(const struct mapping_binding *b) {
+    if (b->byte == 0)
+        return true; /* unbound */
+    return b->report_id < MAPPING_REPORTS && b->byte < MAPPING_REPORT_SIZE &&
+           b->min <= b->max && b->max <= 100;
+}
+
+/* rebuild the lookup table from the slots */
+static void mapping_index(struct mapping *m) {
+    memset(m->first, MAPPING_NONE, sizeof(m->first));
+    memset(m->next, MAPPING_NONE, sizeof(m->next));
+
+    /* walk backwards so the chains end up in slot order */
+    for (int slot = m->count - 1; slot >= 0; slot--) {
+        const struct mapping_binding *b = &m->slots[slot];
+
+        if (b->byte == 0)
+            continue;
+        m->next[slot] = m->first[b->report_id][b->byte];
+        m->first[b->report_id][b->byte] = slot;
+    }
+}
+
+void mapping_init(struct mapping *m, uint8_t count) {
+    memset(m->slots, 0, sizeof(m->slots));
+    m->count = count > MAPPING_SLOTS ? MAPPING_SLOTS : count;
+    mapping_index(m);
+}
+
+bool mapping_set(struct mapping *m, uint8_t slot, const struct mapping_binding *b) {
+    if (slot >= m->count || !mapping_valid(b))
+        return false;
+    m->slots[slot] = *b;
+    mapping_index(m);
+    return true;
+}
+
+const struct mapping_binding *mapping_get(const struct mapping *m, uint8_t slot) {
+    if (slot >= m->count)
+        return NULL;
+    return &m->slots[slot];
+}
+
+int32_t mapping_apply(const struct mapping_binding *b, int32_t value_q8) {
+    int32_t v = value_q8 * b->scale / 256 + b->offset;
+
+    if (v < b->min * 256)
+        v = b->min * 256;
+    if (v > b->max * 256)
+        v = b->max * 256;
+    return v;
+}
+
+void mapping_dispatch(const struct mapping *m, const uint8_t *buffer, uint16_t bufsize, mapping_out_fn out) {
+    uint8_t report_id = buffer[0];
+
+    if (report_id >= MAPPING_REPORTS)
+        return;
+    if (bufsize > MAPPING_REPORT_SIZE)
+        bufsize = MAPPING_REPORT_SIZE;
+
+    /* buffer[i - 1] is byte i on the PC side */
+    for (uint16_t byte = 1; byte <= bufsize && byte < MAPPING_REPORT_SIZE; byte++) {
+        for (uint8_t slot = m->first[report_id][byte]; slot != MAPPING_NONE; slot = m->next[slot])
+            out(slot, mapping_apply(&m->slots[slot], buffer[byte - 1] * 256));
+    }
+}
+
+void mapping_dispatch_value(const struct mapping *m, uint8_t report_id, uint8_t byte, int32_t value_q8, mapping_out_fn out) {
+    if (report_id >= MAPPING_REPORTS || byte >= MAPPING_REPORT_SIZE)
+        return;
+    for (uint8_t slot = m->first[report_id][byte]; slot != MAPPING_NONE; slot = m->next[slot])
+        out(slot, mapping_apply(&m->slots[slot], value_q8));
+}
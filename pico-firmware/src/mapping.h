@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef MAPPING_H_
+#define MAPPING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Table driven mapping of report bytes to meters.
+ * Every meter slot is bound to one byte of one report. The value of that byte
+ * is scaled, offset and clamped before it goes to the meter.
+ * A lookup table indexed by report and byte gives the slots bound to a byte,
+ * so dispatching a report costs one table lookup per byte.
+ * Values are percent in Q8.8 fixed point (256 is 1%).
+ * No pico-sdk in here, this builds for the host as well.
+ */
+
+#define MAPPING_SLOTS 8         /* most meters that can be mapped */
+#define MAPPING_REPORTS 4       /* report ids 0-3 can be mapped */
+#define MAPPING_REPORT_SIZE 64
+#define MAPPING_NONE 0xff
+#define MAPPING_VERSION 1       /* bump when struct mapping_binding changes */
+
+struct mapping_binding {
+    uint8_t report_id;
+    uint8_t byte;       /* byte of the report counted like on the PC side (1-63), 0 is unbound */
+    int16_t scale;      /* Q8.8, 256 is 1:1 */
+    int16_t offset;     /* added after scaling, percent Q8.8 */
+    uint8_t min;        /* result is clamped to min-max percent */
+    uint8_t max;
+};
+
+struct mapping {
+    uint8_t count;
+    struct mapping_binding slots[MAPPING_SLOTS];
+    /* first slot bound to a byte and the next slot bound to the same byte */
+    uint8_t first[MAPPING_REPORTS][MAPPING_REPORT_SIZE];
+    uint8_t next[MAPPING_SLOTS];
+};
+
+/* called for every slot that got a new value */
+typedef void (*mapping_out_fn)(uint8_t slot, int32_t value_q8);
+
+void mapping_init(struct mapping *m, uint8_t count);
+/* returns false if slot or binding are invalid, the mapping is unchanged then */
+bool mapping_set(struct mapping *m, uint8_t slot, const struct mapping_binding *b);
+const struct mapping_binding *mapping_get(const struct mapping *m, uint8_t slot);
+/* scale, offset and clamp a raw value of the bound byte in Q8.8 */
+int32_t mapping_apply(const struct mapping_binding *b, int32_t value_q8);
+/*
+ * Hand every mapped byte of a report to out.
+ * buffer[0] is the report id (byte 1 on the PC side, tinyusb cut off byte 0).
+ */
+void mapping_dispatch(const struct mapping *m, const uint8_t *buffer, uint16_t bufsize, mapping_out_fn out);
+/* hand one value (Q8.8) of byte of a report to the slots bound to it, byte counted like on the PC side */
+void mapping_dispatch_value(const struct mapping *m, uint8_t report_id, uint8_t byte, int32_t value_q8, mapping_out_fn out);
+
+#endif // MAPPING_H_
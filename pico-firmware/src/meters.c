@@ -33,13 +33,24 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
 #include "meters.h"
 #include "hardware/pwm.h"
 #include "bsp/board.h"
 #include "WS2812.pio.h"
 #include "ws2812.h"
 #include "tusb.h"
+#include "sched.h"
+#include "spsc.h"
+#include "mapping.h"
+#include "report.h"
+#include "storage.h"
+#include "calibration.h"
+#include "filter.h"
 
 /* #define DEBUG */
 #ifdef DEBUG
@@ -47,42 +58,101 @@
 #endif
 
 //Constants
-const int METER_PINS[NUMBER_OF_METERS] = {3, 4};     // Meter output pins
-// Set this value to correct cheap meters that display wrong
-// also if you have 3V meters tune this down so it shows 3V at 100% CPU load
-const int METER_MAX[NUMBER_OF_METERS] = {228, 228};    // Max value for meters
-const int METER_UPDATE_FREQ = 100;      // Frequency of meter updates in milliseconds
+// Pins, calibration, LEDs, data source and filter of each meter are in
+// METER_CONFIG, generated from meters_config.cmake
+const int METER_UPDATE_FREQ = 20;       // Frequency of LED updates in milliseconds
+const int NEEDLE_TICK_US = 1000;        // Period of the needle filters and PWM updates
+#define METER_PWM_WRAP 8191             // 13 bit PWM, ~15kHz at clkdiv 1
+const int SCREENSAVER_FREQ = 100;       // Frequency of screen saver steps in milliseconds
 const long SERIAL_TIMEOUT = 2000;       // How long to wait until serial "times out"
-#define READINGS_COUNT 20          // Number of readings to average for each meter
-#define ENDSTDIN 255
 
 //Variables
-#define numRecChars  32            // Sets size of receive buffer
+#define numRecChars  64            // Sets size of receive buffer
 char receivedChars[numRecChars];        // Array for received serial data
 bool newData = false;                   // Indicates if new data has been received
-unsigned long lastSerialRecd = 0;       // Time last serial recd
-unsigned long lastMeterUpdate = 0;      // Time meters last updated
-int lastValueReceived[NUMBER_OF_METERS] = {0};      // Last value received
-int valuesRecd[NUMBER_OF_METERS][READINGS_COUNT];      // Readings to be averaged
-int runningTotal[NUMBER_OF_METERS] = {0};           // Running totals
-int valuesRecdIndex = 0;                // Index of current reading
-
-// Values for WS2812 LED strip
-#define WS2812_PIN 2
-#define WS2812_IS_RGBW false
-const int WS2812_LEN = 4 * NUMBER_OF_METERS;
-struct WS2812* led_strip;
+volatile uint32_t lastSerialRecd = 0;   // Time last serial recd, written by core 0
+volatile uint16_t lastValueReceived[NUMBER_OF_METERS] = {0}; // Last value received
+volatile uint16_t needleValue[NUMBER_OF_METERS] = {0};       // Where the needles are now
+volatile uint16_t screenSaverValue[NUMBER_OF_METERS] = {0};  // Needles while no data comes in
+struct filter meterFilter[NUMBER_OF_METERS];        // Smoothing of each needle, core 1
+#ifdef PCMETER_PWM_DITHER
+static uint16_t ditherRest[NUMBER_OF_METERS];       // Sigma-delta state of each needle
+#endif
+
+// WS2812 LED strips, pins are in WS2812_PINS
+struct WS2812_group* led_strips;
+
+// Scheduler the serial task runs on (core 0)
+struct sched *meterSched = NULL;
+int8_t serialTask = -1;
+int8_t saveTask = -1;
+static bool saveMappingPending = false;
+static uint8_t saveCalibrationPending = 0;   // bit per meter
+static bool saveFailed = false;              // the last write to flash failed
+
+// Which report byte goes to which meter, starts out from METER_CONFIG,
+// can be changed by feature reports and is kept in flash. Core 0 only.
+static struct mapping meterMapping;
+static bool mappedValueFed;
+// Sequence numbers and counters of the v2 reports, core 0 only
+static struct report_stats reportStats;
+
+_Static_assert(NUMBER_OF_METERS <= MAPPING_SLOTS, "too many meters for the mapping engine");
+
+struct mapping_record {
+    uint8_t version;
+    uint8_t count;
+    struct mapping_binding slots[MAPPING_SLOTS];
+};
+
+// Calibration curve of every meter. Core 0 owns the curves, core 1 turns
+// them into lookup tables whenever calGeneration changes.
+_Static_assert(NUMBER_OF_METERS <= STORAGE_CALIBRATION_KEYS, "too many meters for the calibration store");
+static struct cal_curve calCurves[NUMBER_OF_METERS];
+static volatile uint32_t calGeneration = 0;
+static uint32_t calLutGeneration = 0;
+static uint16_t calLut[NUMBER_OF_METERS][CAL_LUT_SIZE];
+
+// Rendering of meters and LEDs runs on core 1 with its own scheduler,
+// new values come in from core 0 through this ring
+static struct spsc samples;
+static struct sched renderSched;
+static alarm_pool_t *renderAlarms;
+static struct repeating_timer needleTimer;
 
 // Arduino map function
 long map(long x, long in_min, long in_max, long out_min, long out_max) {
   return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
 }
 
-//Set Meter position
-static void setMeter(int meterPin, int perc, int meterMax) {
-  //Map perc to proper meter position
-  int pos = map(perc, 0, 100, 0, meterMax);
-  pwm_set_gpio_level(meterPin, pos);
+// Rebuild the lookup tables if core 0 changed a calibration curve, core 1
+static void updateCalibration(void) {
+  uint32_t gen = calGeneration;
+
+  if (gen == calLutGeneration)
+    return;
+  __dmb();
+  for (uint8_t i = 0; i < NUMBER_OF_METERS; i++)
+    calibration_lut(&calCurves[i], calLut[i]);
+  calLutGeneration = gen;
+}
+
+//Set Meter position, value is 0-METER_VALUE_MAX
+static void setMeter(uint8_t meter, uint16_t value) {
+  //Look up the calibrated meter position and scale it to the PWM wrap
+  uint32_t level = (uint32_t)calibration_lookup(calLut[meter], value) * (METER_PWM_WRAP + 1);
+  uint16_t frac = level & 0xffff;
+
+  level >>= 16;
+#ifdef PCMETER_PWM_DITHER
+  //Alternate between the two closest levels so the average lands in between
+  if ((uint32_t)ditherRest[meter] + frac > 0xffff)
+    level++;
+  ditherRest[meter] += frac;
+#else
+  (void)frac;
+#endif
+  pwm_set_gpio_level(METER_CONFIG[meter].pin, level);
 }
 
 static void map_percent_green_to_red (uint8_t percent, uint8_t *r, uint8_t *g, uint8_t *b) {
@@ -93,57 +163,230 @@ static void map_percent_green_to_red (uint8_t percent, uint8_t *r, uint8_t *g, u
 }
 
 static void setLEDStrip(uint8_t meteridx, uint8_t percent) {
-    uint8_t r,g,b, i0, i1, i2, i3;
+    uint8_t r,g,b;
+    const struct meter_config *cfg = &METER_CONFIG[meteridx];
+    struct WS2812* led_strip = ws2812_group_get_strip(led_strips, cfg->led_strip);
     map_percent_green_to_red(percent, &r,&g,&b);
 
-    i0 = meteridx * 4;
-    i1 = meteridx * 4 + 1;
-    i2 = meteridx * 4 + 2;
-    i3 = meteridx * 4 + 3;
-    ws2812_set_led(led_strip, i0, ws2812_urgb_grbu32(r, g, b));
-    ws2812_set_led(led_strip, i1, ws2812_urgb_grbu32(r, g, b));
-    ws2812_set_led(led_strip, i2, ws2812_urgb_grbu32(r, g, b));
-    ws2812_set_led(led_strip, i3, ws2812_urgb_grbu32(r, g, b));
+    for (uint16_t i = 0; i < cfg->led_count; i++)
+      ws2812_set_led(led_strip, cfg->led_first + i, ws2812_urgb_grbu32(r, g, b));
 }
 
 //Max both meters on startup as a test
 static void meterStartup(void) {
-  ws2812_fill(led_strip, ws2812_urgb_grbu32(0, 0, 0));
-  ws2812_show(led_strip);
+  for (uint8_t i = 0; i < ws2812_group_get_count(led_strips); i++)
+    ws2812_fill(ws2812_group_get_strip(led_strips, i), ws2812_urgb_grbu32(0, 0, 0));
+  ws2812_group_show(led_strips);
   for (int i = 0; i<100; i++) {
     for (uint8_t j = 0; j < NUMBER_OF_METERS; j++)
-      setMeter(METER_PINS[j], i, METER_MAX[j]);
+      setMeter(j, i * METER_VALUE_MAX / 100);
     sleep_ms(5);
   }
   for (int i = 100; i>0; i--) {
     for (uint8_t j = 0; j < NUMBER_OF_METERS; j++)
-      setMeter(METER_PINS[j], i, METER_MAX[j]);
+      setMeter(j, i * METER_VALUE_MAX / 100);
     sleep_ms(5);
   }
 }
 
-void meters_setup(void) {
-    uint* slice_num = malloc(NUMBER_OF_METERS * sizeof(uint));
+static bool needleTick(struct repeating_timer *t);
+
+// Entry point of core 1, owns the PWM slices and the LED strip
+static void meters_renderCore(void) {
+    // core 0 pauses us while it writes to the flash
+    multicore_lockout_victim_init();
+
+    calLutGeneration = calGeneration - 1;
+    updateCalibration();
+
     for (uint8_t j = 0; j < NUMBER_OF_METERS; j++) {
-      gpio_set_function(METER_PINS[j], GPIO_FUNC_PWM);
-      gpio_set_function(METER_PINS[j], GPIO_FUNC_PWM);
-      slice_num[j] = pwm_gpio_to_slice_num(METER_PINS[j]),
-      pwm_set_wrap(slice_num[j], 254);
-      pwm_set_enabled(slice_num[j], true);
-      pwm_set_enabled(slice_num[j], true);
-
-      //Init values Received array
-      for (int counter = 0; counter < READINGS_COUNT; counter++)
-        valuesRecd[j][counter] = 0;
+      uint slice_num = pwm_gpio_to_slice_num(METER_CONFIG[j].pin);
+
+      gpio_set_function(METER_CONFIG[j].pin, GPIO_FUNC_PWM);
+      pwm_set_clkdiv(slice_num, 1.f);
+      pwm_set_wrap(slice_num, METER_PWM_WRAP);
+      pwm_set_enabled(slice_num, true);
+
+      filter_init(&meterFilter[j], METER_CONFIG[j].filter, METER_CONFIG[j].filter_time, NEEDLE_TICK_US / 1000);
     }
 
-    led_strip = ws2812_initialize(pio0, 0, WS2812_PIN, WS2812_LEN, WS2812_IS_RGBW);
+    // alarms of this pool fire on core 1
+    renderAlarms = alarm_pool_create_with_unused_hardware_alarm(4);
+    ws2812_set_alarm_pool(renderAlarms);
+    uint16_t lengths[WS2812_STRIPS];
+    memcpy(lengths, WS2812_LENGTHS, sizeof(lengths));
+    for (uint8_t j = 0; j < NUMBER_OF_METERS; j++) {
+      const struct meter_config *cfg = &METER_CONFIG[j];
+      lengths[cfg->led_strip] = MAX(lengths[cfg->led_strip], cfg->led_first + cfg->led_count);
+    }
+    led_strips = ws2812_group_initialize(WS2812_PINS, lengths, WS2812_STRIPS, WS2812_IS_RGBW);
 
     meterStartup();
 
+    sched_init(&renderSched, board_millis);
+    // negative period: the tick is timed from its start, not its end
+    alarm_pool_add_repeating_timer_us(renderAlarms, -NEEDLE_TICK_US, needleTick, NULL, &needleTimer);
+    sched_add(&renderSched, meters_updateLEDs, METER_UPDATE_FREQ);
+    sched_add(&renderSched, meters_screenSaver, SCREENSAVER_FREQ);
+
+    while (1) {
+      struct meter_sample sample;
+
+      while (spsc_pop(&samples, &sample))
+        lastValueReceived[sample.idx] = sample.val;
+
+      uint32_t idle_ms = sched_run(&renderSched);
+      // core 0 does a __sev() when it pushes a sample
+      if (idle_ms && spsc_empty(&samples))
+        best_effort_wfe_or_timeout(make_timeout_time_ms(idle_ms));
+    }
+}
+
+void meters_defaultMapping(void) {
+    mapping_init(&meterMapping, NUMBER_OF_METERS);
+    for (uint8_t i = 0; i < NUMBER_OF_METERS; i++) {
+      struct mapping_binding b = {
+        .report_id = METER_CONFIG[i].report_id,
+        .byte = METER_CONFIG[i].report_byte,
+        .scale = METER_CONFIG[i].scale * 256 / 100,
+        .offset = 0,
+        .min = 0,
+        .max = 100,
+      };
+      mapping_set(&meterMapping, i, &b);
+    }
+}
+
+static void meters_loadMapping(void) {
+    struct mapping_record rec;
+
+    meters_defaultMapping();
+    if (!storage_load(STORAGE_KEY_MAPPING, &rec, sizeof(rec)))
+      return;
+    // a mapping for a different meter configuration is of no use
+    if (rec.version != MAPPING_VERSION || rec.count != NUMBER_OF_METERS)
+      return;
+    for (uint8_t i = 0; i < rec.count; i++)
+      mapping_set(&meterMapping, i, &rec.slots[i]);
+}
+
+// Without calibration MAX from meters_config.cmake is 100%
+void meters_defaultCalibration(uint8_t meter) {
+    if (meter >= NUMBER_OF_METERS)
+      return;
+    calibration_linear(&calCurves[meter], METER_CONFIG[meter].max * 257);
+    __dmb();
+    calGeneration++;
+}
+
+static void meters_loadCalibration(void) {
+    for (uint8_t i = 0; i < NUMBER_OF_METERS; i++) {
+      struct cal_curve c;
+
+      if (storage_load(STORAGE_KEY_CALIBRATION + i, &c, sizeof(c)) && calibration_valid(&c))
+        calCurves[i] = c;
+      else
+        calibration_linear(&calCurves[i], METER_CONFIG[i].max * 257);
+    }
+    calGeneration++;
+}
+
+const struct cal_curve *meters_getCalibration(uint8_t meter) {
+    if (meter >= NUMBER_OF_METERS)
+      return NULL;
+    return &calCurves[meter];
+}
+
+bool meters_setCalibration(uint8_t meter, const struct cal_curve *c) {
+    if (meter >= NUMBER_OF_METERS || !calibration_valid(c))
+      return false;
+    calCurves[meter] = *c;
+    // make the curve visible to core 1 before it sees the new generation
+    __dmb();
+    calGeneration++;
+    return true;
+}
+
+void meters_saveCalibration(uint8_t meter) {
+    if (meter >= NUMBER_OF_METERS || !meterSched)
+      return;
+    saveCalibrationPending |= 1 << meter;
+    sched_wake(meterSched, saveTask);
+}
+
+// Writes whatever was asked to be saved, takes some ms per record.
+// What could not be written stays pending and is tried again with the next save.
+static void meters_saveTask(void) {
+    if (saveMappingPending) {
+      struct mapping_record rec;
+
+      memset(&rec, 0, sizeof(rec));
+      rec.version = MAPPING_VERSION;
+      rec.count = meterMapping.count;
+      memcpy(rec.slots, meterMapping.slots, sizeof(rec.slots));
+      saveFailed = !storage_save(STORAGE_KEY_MAPPING, &rec, sizeof(rec));
+      if (saveFailed)
+        return;
+      saveMappingPending = false;
+    }
+    for (uint8_t i = 0; i < NUMBER_OF_METERS; i++) {
+      if (!(saveCalibrationPending & (1 << i)))
+        continue;
+      saveFailed = !storage_save(STORAGE_KEY_CALIBRATION + i, &calCurves[i], sizeof(calCurves[i]));
+      if (saveFailed)
+        return;
+      saveCalibrationPending &= ~(1 << i);
+    }
+}
+
+bool meters_getSaveState(bool *mapping, uint8_t *calibration) {
+    *mapping = saveMappingPending;
+    *calibration = saveCalibrationPending;
+    return !saveFailed;
+}
+
+void meters_saveMapping(void) {
+    if (!meterSched)
+      return;
+    saveMappingPending = true;
+    sched_wake(meterSched, saveTask);
+}
+
+struct mapping *meters_getMapping(void) {
+    return &meterMapping;
+}
+
+void meters_setup(void) {
+    spsc_init(&samples);
+    report_init(&reportStats);
+    meters_loadMapping();
+    meters_loadCalibration();
+
     //Get times started
-    lastMeterUpdate = board_millis();
     lastSerialRecd = board_millis();
+
+    multicore_launch_core1(meters_renderCore);
+}
+
+static void meters_serialTask(void);
+
+void meters_registerTasks(struct sched *s) {
+    meterSched = s;
+    serialTask = sched_add(s, meters_serialTask, 0);
+    saveTask = sched_add(s, meters_saveTask, 0);
+}
+
+void meters_serialAvailable(void) {
+    if (meterSched)
+      sched_wake(meterSched, serialTask);
+}
+
+static void meters_serialTask(void) {
+    meters_receiveSerialData();
+    meters_updateStats();
+    // there is more than one line waiting, come back
+    if (tud_cdc_n_available(0))
+      sched_wake(meterSched, serialTask);
 }
 
 void meters_receiveSerialData(void) {
@@ -172,17 +415,57 @@ void meters_receiveSerialData(void) {
     }
 }
 
+// Parse "<meter>,<in>:<out>,<in>:<out>..." where in is percent and out is
+// 0-255 like MAX in meters_config.cmake
+static void serialCalibration(char *line) {
+  struct cal_curve c;
+  char *p = line;
+  long meter = strtol(p, &p, 10);
+
+  memset(&c, 0, sizeof(c));
+  c.version = CAL_VERSION;
+  while (*p == ',' && c.count < CAL_POINTS) {
+    long in = strtol(p + 1, &p, 10);
+    if (*p != ':')
+      break;
+    long out = strtol(p + 1, &p, 10);
+    c.points[c.count].in = MIN(MAX(in, 0), 255);
+    c.points[c.count].out = MIN(MAX(out, 0), 255) * 257;
+    c.count++;
+  }
+  if (meter < 0 || !meters_setCalibration(meter, &c)) {
+#ifdef DEBUG
+    printf("calibration rejected: %s\n", line);
+#endif
+  }
+}
+
 void meters_updateStats(void) {
   if (newData == true) {
     switch (receivedChars[0]) {
+#ifdef HAVE_METER_CPU
       case 'C':
         //CPU
-        lastValueReceived[CPU] = MIN(atoi(&receivedChars[1]), 100);
+        updateLastValueReceived(CPU, MIN(MAX(atoi(&receivedChars[1]), 0), 100) * METER_VALUE_MAX / 100);
         break;
+#endif
+#ifdef HAVE_METER_MEM
       case 'M':
         //Memory
-        lastValueReceived[MEM] = MIN(atoi(&receivedChars[1]), 100);
+        updateLastValueReceived(MEM, MIN(MAX(atoi(&receivedChars[1]), 0), 100) * METER_VALUE_MAX / 100);
         break;
+#endif
+      case 'K':
+        //Calibration curve, e.g. K0,0:0,50:120,100:228
+        serialCalibration(&receivedChars[1]);
+        //not a value, do not stop the screen saver
+        newData = false;
+        return;
+      case 'W':
+        //Write the calibration of a meter to flash, e.g. W0
+        meters_saveCalibration(atoi(&receivedChars[1]));
+        newData = false;
+        return;
     }
 
     //Update last serial received
@@ -193,83 +476,102 @@ void meters_updateStats(void) {
   }
 }
 
-void updateLastValueReceived(int idx, int val) {
-  lastValueReceived[idx] = val;
+// Called on core 0, hands the value over to the render core
+void updateLastValueReceived(int idx, uint16_t val) {
+  struct meter_sample sample = { .idx = idx, .val = val };
+
+  if (idx < 0 || idx >= NUMBER_OF_METERS)
+    return;
+  if (spsc_push(&samples, sample))
+    __sev();
 }
 
 void updateLastTimeReceived(void) {
   lastSerialRecd = board_millis();
 }
 
-//Update meters and running stats
-void meters_updateMeters(void) {
-  unsigned long currentMillis = board_millis();
+static void meters_mappedValue(uint8_t slot, int32_t value_q8) {
+  //percent in Q8.8 to 0-METER_VALUE_MAX, the mapping clamped it to 0-100%
+  updateLastValueReceived(slot, value_q8 * METER_VALUE_MAX / (100 * 256));
+  mappedValueFed = true;
+}
 
-  if (currentMillis - lastMeterUpdate > METER_UPDATE_FREQ)
-  {
-    //Update both meters
-    int i;
-    for(i = 0; i < NUMBER_OF_METERS; i++) {
-      int perc = 0;
+static void meters_reportValue(uint8_t report_id, uint8_t byte, uint16_t value_q8) {
+  mapping_dispatch_value(&meterMapping, report_id, byte, value_q8, meters_mappedValue);
+}
 
-      //Based on https://www.arduino.cc/en/Tutorial/Smoothing
-      runningTotal[i] = runningTotal[i] - valuesRecd[i][valuesRecdIndex];
-      valuesRecd[i][valuesRecdIndex] = lastValueReceived[i];
-      runningTotal[i] = runningTotal[i] + valuesRecd[i][valuesRecdIndex];
-      perc = runningTotal[i] / READINGS_COUNT;
+// Feed every meter that is mapped to a byte of this report.
+// tinyusb cut off the report number, so buffer[0] is byte 1 on the PC side
+void meters_handleReport(uint8_t const* buffer, uint16_t bufsize) {
+  mappedValueFed = false;
+  if (report_is_v2(buffer, bufsize))
+    report_parse_v2(&reportStats, buffer, bufsize, meters_reportValue);
+  else
+    mapping_dispatch(&meterMapping, buffer, bufsize, meters_mappedValue);
+  if (mappedValueFed)
+    updateLastTimeReceived();
+}
 
-      setMeter(METER_PINS[i], perc, METER_MAX[i]);
-      setLEDStrip(i, perc);
-    }
-    ws2812_show(led_strip);
+const struct report_stats *meters_getReportStats(void) {
+  return &reportStats;
+}
+
+static bool screenSaverActive(void) {
+  return board_millis() - lastSerialRecd > SERIAL_TIMEOUT;
+}
+
+//Step the needle filters and move the needles, runs every NEEDLE_TICK_US
+//in a timer interrupt on core 1
+static bool needleTick(struct repeating_timer *t) {
+  (void)t;
+  updateCalibration();
 
-    //Advance index
-    valuesRecdIndex = valuesRecdIndex + 1;
-    if (valuesRecdIndex >= READINGS_COUNT)
-      valuesRecdIndex = 0;
+  // the screen saver owns the needles while no data comes in
+  bool saver = screenSaverActive();
+  for (uint8_t i = 0; i < NUMBER_OF_METERS; i++) {
+    uint16_t target = saver ? screenSaverValue[i] : lastValueReceived[i];
 
-    lastMeterUpdate = currentMillis;
+    needleValue[i] = filter_step(&meterFilter[i], target);
+    setMeter(i, needleValue[i]);
   }
+  return true;
+}
+
+//Update LEDs to where the needles are, runs every METER_UPDATE_FREQ ms on core 1
+void meters_updateLEDs(void) {
+  for (uint8_t i = 0; i < NUMBER_OF_METERS; i++)
+    setLEDStrip(i, (needleValue[i] * 100 + METER_VALUE_MAX / 2) / METER_VALUE_MAX);
+  // if the last frame is still going out, this one is skipped
+  ws2812_group_show(led_strips);
 }
 
 //Move needles back and forth to show no data is
 //being received. Stop once serial data rec'd again.
+//Runs every SCREENSAVER_FREQ ms on core 1
 void meters_screenSaver(void) {
-  if (board_millis() - lastSerialRecd > SERIAL_TIMEOUT) {
+  if (screenSaverActive()) {
     static int aPos = 0;
     int bPos = 0;
     static int incAmt = 0;
-    static unsigned long lastSSUpdate = 0;
-
-    char in = getchar_timeout_us(0);
-    if (in == ENDSTDIN || in < 0) {
-      unsigned long currentMillis = board_millis();
 
-      //B meter position is opposite of A meter position
-      bPos = 100 - aPos;
-
-      //Move needles
-      for (uint8_t j = 0; j < NUMBER_OF_METERS; j+=2) {
-        setMeter(METER_PINS[j], aPos, METER_MAX[j]);
-      }
-      for (uint8_t j = 1; j < NUMBER_OF_METERS; j+=2) {
-        setMeter(METER_PINS[j], bPos, METER_MAX[j]);
-      }
+    //B meter position is opposite of A meter position
+    bPos = 100 - aPos;
 
-      //Update every 100ms
-      if (currentMillis - lastSSUpdate > 100) {
-        lastSSUpdate = board_millis();
+    //Move needles, needleTick() takes them there
+    for (uint8_t j = 0; j < NUMBER_OF_METERS; j+=2) {
+      screenSaverValue[j] = aPos * METER_VALUE_MAX / 100;
+    }
+    for (uint8_t j = 1; j < NUMBER_OF_METERS; j+=2) {
+      screenSaverValue[j] = bPos * METER_VALUE_MAX / 100;
+    }
 
-        //Change meter direction if needed.
-        if (aPos == 100)
-          incAmt = -1;
-        else if (aPos == 0)
-          incAmt = 1;
+    //Change meter direction if needed.
+    if (aPos == 100)
+      incAmt = -1;
+    else if (aPos == 0)
+      incAmt = 1;
 
-        //Increment position
-        aPos = aPos + incAmt;
-        lastSSUpdate = currentMillis;
-      }
-    }
+    //Increment position
+    aPos = aPos + incAmt;
   }
 }
@@ -4,19 +4,51 @@
 #ifndef METERS_H_
 #define METERS_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "meters_config.h"
+
+/* meter values are 16 bit, this is 100% */
+#define METER_VALUE_MAX 65535
+
+struct sched;
+struct mapping;
+struct cal_curve;
+struct report_stats;
+
+/* starts the rendering of meters and LEDs on core 1 */
 void meters_setup(void);
+/* put the serial task onto the scheduler of core 0 */
+void meters_registerTasks(struct sched *s);
+/* call when data arrived on the serial port */
+void meters_serialAvailable(void);
 void meters_receiveSerialData(void);
 void meters_updateStats(void);
-void meters_updateMeters(void);
+/* these two run on core 1, the needles themselves move in a timer there */
+void meters_updateLEDs(void);
 void meters_screenSaver(void);
-void updateLastValueReceived(int idx, int val);
+/* call from core 0 only, val is 0-METER_VALUE_MAX */
+void updateLastValueReceived(int idx, uint16_t val);
 void updateLastTimeReceived(void);
+/* pass the values of a HID report (legacy or v2) to the meters mapped to it, call from core 0 */
+void meters_handleReport(uint8_t const* buffer, uint16_t bufsize);
+/* counters of received, lost and reordered v2 reports */
+const struct report_stats *meters_getReportStats(void);
+/* the report to meter mapping, core 0 only */
+struct mapping *meters_getMapping(void);
+/* go back to the mapping from meters_config.cmake */
+void meters_defaultMapping(void);
+/* store the mapping in flash, happens in the background */
+void meters_saveMapping(void);
+/* calibration curves, core 0 only, core 1 picks up changes by itself */
+const struct cal_curve *meters_getCalibration(uint8_t meter);
+bool meters_setCalibration(uint8_t meter, const struct cal_curve *c);
+/* go back to a straight line up to MAX from meters_config.cmake (not saved) */
+void meters_defaultCalibration(uint8_t meter);
+/* store the calibration of a meter in flash, happens in the background */
+void meters_saveCalibration(uint8_t meter);
+/* saves not written yet (calibration is a bit per meter), false if the last write to flash failed */
+bool meters_getSaveState(bool *mapping, uint8_t *calibration);
 long map(long x, long in_min, long in_max, long out_min, long out_max);
 
-enum {
-    CPU = 0,
-    MEM = 1,
-    NUMBER_OF_METERS,
-};
-
 #endif // METERS_H_
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include <string.h>
+#include "report.h"
+
+/* pcmeter_protocol.h counts like the PC side, tinyusb cut off byte 0 */
+#define AT(off) ((off) - 1)
+
+void report_init(struct report_stats *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+bool report_is_v2(uint8_t const* buffer, uint16_t bufsize) {
+    return bufsize > AT(PCM_V2_OFF_TLV) && buffer[AT(1)] == PCM_REPORT_V2;
+}
+
+/* true if the report is newer than the last one of its stream */
+static bool report_sequence(struct report_stats *s, uint8_t stream, uint8_t flags, uint16_t seq) {
+    int16_t diff;
+
+    /* unknown streams are taken as they come */
+    if (stream >= PCM_STREAMS)
+        return true;
+
+    diff = (int16_t)(seq - s->last_seq[stream]);
+    if (s->have_seq[stream] && !(flags & PCM_V2_FLAG_RESET) && diff > -REPORT_REORDER_WINDOW) {
+        if (diff <= 0) {
+            s->reordered++;
+            return false;
+        }
+        s->lost += diff - 1;
+    }
+    s->last_seq[stream] = seq;
+    s->have_seq[stream] = true;
+    return true;
+}
+
+/* one part of a per-core frame, v is the value of the TLV */
+static bool report_cores(struct report_cores *rc, uint8_t const* v, uint8_t len, report_value_fn out) {
+    uint16_t frame, ncores, off;
+    uint8_t part, parts;
+
+    if (len < PCM_CORES_HDR)
+        return false;
+    frame = pcm_get_le16(&v[0]);
+    part = v[2];
+    parts = v[PCM_CORES_OFF_PARTS];
+    ncores = pcm_get_le16(&v[4]);
+    if (parts == 0 || parts > PCM_CORES_PARTS_MAX || part >= parts)
+        return false;
+    if (ncores > PCM_CORES_MAX)
+        ncores = PCM_CORES_MAX;
+
+    if (!rc->staging || frame != rc->frame) {
+        /* a new frame, the one before never got all its parts */
+        if (rc->staging)
+            rc->dropped++;
+        /* cores that are not sent keep their load */
+        memcpy(rc->staged, rc->load, sizeof(rc->staged));
+        rc->frame = frame;
+        rc->parts = parts;
+        rc->parts_seen = 0;
+        rc->staging = true;
+    }
+    if (parts != rc->parts)
+        return false;
+    rc->staged_count = ncores;
+
+    for (off = PCM_CORES_HDR; off + PCM_CORES_RUN_HDR <= len;) {
+        uint16_t first = pcm_get_le16(&v[off]);
+        uint8_t n = v[off + 2];
+
+        if (off + PCM_CORES_RUN_HDR + n > len)
+            return false;
+        for (uint8_t i = 0; i < n; i++) {
+            if (first + i < PCM_CORES_MAX)
+                rc->staged[first + i] = v[off + PCM_CORES_RUN_HDR + i];
+        }
+        off += PCM_CORES_RUN_HDR + n;
+    }
+
+    rc->parts_seen |= 1u << part;
+    if (rc->parts_seen != (parts == 32 ? 0xffffffff : (1u << parts) - 1))
+        return true;
+
+    /* all parts are there */
+    memcpy(rc->load, rc->staged, ncores);
+    memset(&rc->load[ncores], 0, PCM_CORES_MAX - ncores);
+    rc->count = ncores;
+    rc->staging = false;
+    rc->complete++;
+    for (uint16_t i = 0; i < rc->count && PCM_SYS_CORE0 + i < PCM_REPORT_SIZE; i++)
+        out(PCM_REPORT_SYSTEM, PCM_SYS_CORE0 + i, rc->load[i] << 8);
+    return true;
+}
+
+bool report_parse_v2(struct report_stats *s, uint8_t const* buffer, uint16_t bufsize, report_value_fn out) {
+    uint16_t off = AT(PCM_V2_OFF_TLV);
+
+    if (!report_is_v2(buffer, bufsize) || buffer[AT(PCM_V2_OFF_VERSION)] != PCM_V2_VERSION) {
+        s->malformed++;
+        return false;
+    }
+    s->frames++;
+    if (!report_sequence(s, buffer[AT(PCM_V2_OFF_STREAM)], buffer[AT(PCM_V2_OFF_FLAGS)],
+                         pcm_get_le16(&buffer[AT(PCM_V2_OFF_SEQ)])))
+        return false;
+
+    while (off + PCM_TLV_HDR <= bufsize && buffer[off] != PCM_TLV_END) {
+        uint8_t type = buffer[off];
+        uint8_t len = buffer[off + 1];
+        uint8_t const* v = &buffer[off + PCM_TLV_HDR];
+
+        if (off + PCM_TLV_HDR + len > bufsize) {
+            s->malformed++;
+            return false;
+        }
+        if (type == PCM_TLV_VALUES && len >= PCM_TLV_VALUES_HDR) {
+            /* v[2-3] is the age of the values, the meters show them right away */
+            for (uint8_t i = 0; i < (len - PCM_TLV_VALUES_HDR) / 2; i++)
+                out(v[0], v[1] + i, pcm_get_le16(&v[PCM_TLV_VALUES_HDR + i * 2]));
+        } else if (type == PCM_TLV_CORES && !report_cores(&s->cores, v, len, out)) {
+            s->malformed++;
+            return false;
+        }
+        off += PCM_TLV_HDR + len;
+    }
+    return true;
+}
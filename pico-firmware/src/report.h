@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "pcmeter_protocol.h"
+
+/*
+ * Receiving side of the v2 reports from pcmeter_protocol.h.
+ * Keeps the sequence number of every stream to count lost and reordered
+ * reports. Reports that are older than the last one of their stream are
+ * dropped, so a late report can not move a needle back.
+ * The parts of a per-core frame (PCM_TLV_CORES) are put together in
+ * staged and copied to load once the frame is complete.
+ * No pico-sdk in here, this builds for the host as well.
+ */
+
+/* a report this far behind the last one means the sender started over */
+#define REPORT_REORDER_WINDOW 64
+
+struct report_cores {
+    uint8_t load[PCM_CORES_MAX];    /* percent, from the last complete frame */
+    uint8_t staged[PCM_CORES_MAX];  /* frame that is put together */
+    uint16_t count;                 /* cores in the last complete frame */
+    uint16_t staged_count;
+    uint16_t frame;
+    uint8_t parts;
+    bool staging;
+    uint32_t parts_seen;            /* bit per part */
+    uint32_t complete;
+    uint32_t dropped;               /* frames that missed a part */
+};
+
+struct report_stats {
+    uint32_t frames;
+    uint32_t lost;
+    uint32_t reordered;
+    uint32_t malformed;
+    uint16_t last_seq[PCM_STREAMS];
+    bool have_seq[PCM_STREAMS];
+    struct report_cores cores;
+};
+
+/*
+ * called for every value of a report, value_q8 is the legacy value in Q8.8.
+ * Per-core loads of a complete frame come in here as well, as far as they
+ * have a legacy position (bytes 10-63 of the system report).
+ */
+typedef void (*report_value_fn)(uint8_t report_id, uint8_t byte, uint16_t value_q8);
+
+void report_init(struct report_stats *s);
+/* buffer like in tud_hid_set_report_cb(), buffer[0] is byte 1 on the PC side */
+bool report_is_v2(uint8_t const* buffer, uint16_t bufsize);
+/* returns false if the report was malformed or out of order */
+bool report_parse_v2(struct report_stats *s, uint8_t const* buffer, uint16_t bufsize, report_value_fn out);
+
+#endif // REPORT_H_
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include "sched.h"
+
+/* true if deadline is at or before now, survives the wrap of the ms counter */
+static bool sched_expired(uint32_t deadline, uint32_t now) {
+    return (int32_t)(deadline - now) <= 0;
+}
+
+void sched_init(struct sched *s, sched_clock_fn now_ms) {
+    s->now_ms = now_ms;
+    s->count = 0;
+}
+
+int8_t sched_add(struct sched *s, sched_task_fn fn, uint32_t period_ms) {
+    struct sched_task *t;
+
+    if (!fn || s->count >= SCHED_MAX_TASKS)
+        return -1;
+    t = &s->tasks[s->count];
+    t->fn = fn;
+    t->period_ms = period_ms;
+    t->deadline = s->now_ms() + period_ms;
+    t->pending = false;
+    return s->count++;
+}
+
+void sched_set_period(struct sched *s, int8_t id, uint32_t period_ms) {
+    if (id < 0 || id >= s->count)
+        return;
+    s->tasks[id].period_ms = period_ms;
+    s->tasks[id].deadline = s->now_ms() + period_ms;
+}
+
+void sched_wake(struct sched *s, int8_t id) {
+    if (id < 0 || id >= s->count)
+        return;
+    s->tasks[id].pending = true;
+}
+
+uint32_t sched_run(struct sched *s) {
+    uint32_t now = s->now_ms();
+    uint32_t idle = SCHED_IDLE_MAX_MS;
+
+    for (uint8_t i = 0; i < s->count; i++) {
+        struct sched_task *t = &s->tasks[i];
+        bool due = t->period_ms && sched_expired(t->deadline, now);
+
+        if (t->pending || due) {
+            t->pending = false;
+            if (due) {
+                t->deadline += t->period_ms;
+                /* we were stalled for more than a period, do not try to catch up */
+                if (sched_expired(t->deadline, now))
+                    t->deadline = now + t->period_ms;
+            }
+            t->fn();
+            /* the task may have taken a while */
+            now = s->now_ms();
+        }
+    }
+
+    for (uint8_t i = 0; i < s->count; i++) {
+        struct sched_task *t = &s->tasks[i];
+
+        if (t->pending)
+            return 0;
+        if (!t->period_ms)
+            continue;
+        if (sched_expired(t->deadline, now))
+            return 0;
+        if (t->deadline - now < idle)
+            idle = t->deadline - now;
+    }
+    return idle;
+}
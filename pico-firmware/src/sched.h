@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Small cooperative scheduler.
+ * Every task has a deadline, sched_run() runs the tasks whose deadline expired
+ * and tells the caller how long it may sleep until the next one is due.
+ * Tasks with a period of 0 only run when woken by sched_wake(), e.g. from a
+ * USB callback.
+ * This file does not depend on the pico-sdk, the clock is passed in by the
+ * caller, so it can be built and driven by a fake clock on the host as well.
+ */
+
+#define SCHED_MAX_TASKS 8
+/* longest time sched_run() asks the caller to sleep */
+#define SCHED_IDLE_MAX_MS 1000
+
+typedef uint32_t (*sched_clock_fn)(void);
+typedef void (*sched_task_fn)(void);
+
+struct sched_task {
+    sched_task_fn fn;
+    uint32_t period_ms;
+    uint32_t deadline;
+    volatile bool pending;
+};
+
+struct sched {
+    sched_clock_fn now_ms;
+    struct sched_task tasks[SCHED_MAX_TASKS];
+    uint8_t count;
+};
+
+void sched_init(struct sched *s, sched_clock_fn now_ms);
+/* add a task, returns its id or -1 if the task table is full */
+int8_t sched_add(struct sched *s, sched_task_fn fn, uint32_t period_ms);
+/* change the period of a task, the next deadline is counted from now */
+void sched_set_period(struct sched *s, int8_t id, uint32_t period_ms);
+/* let a task run on the next call of sched_run(), safe to call from callbacks */
+void sched_wake(struct sched *s, int8_t id);
+/* run all due tasks, returns the time in ms until the next deadline */
+uint32_t sched_run(struct sched *s);
+
+#endif // SCHED_H_
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef SPSC_H_
+#define SPSC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free single producer, single consumer ring of meter samples.
+ * One core pushes, the other core pops, no locks or interrupts needed.
+ * SPSC_SIZE must be a power of two.
+ */
+
+#define SPSC_SIZE 32
+
+struct meter_sample {
+    uint8_t idx;
+    uint16_t val;   /* 0-METER_VALUE_MAX */
+};
+
+struct spsc {
+    struct meter_sample buf[SPSC_SIZE];
+    atomic_uint head; /* written by the producer only */
+    atomic_uint tail; /* written by the consumer only */
+};
+
+static inline void spsc_init(struct spsc *r) {
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+}
+
+/* returns false if the ring is full and the sample was dropped */
+static inline bool spsc_push(struct spsc *r, struct meter_sample s) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail >= SPSC_SIZE)
+        return false;
+    r->buf[head & (SPSC_SIZE - 1)] = s;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return true;
+}
+
+/* returns false if the ring is empty */
+static inline bool spsc_pop(struct spsc *r, struct meter_sample *s) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+    *s = r->buf[tail & (SPSC_SIZE - 1)];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static inline bool spsc_empty(struct spsc *r) {
+    return atomic_load_explicit(&r->head, memory_order_acquire) ==
+           atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+#endif // SPSC_H_
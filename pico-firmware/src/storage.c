@@ -0,0 +1,227 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "storage.h"
+
+/*
+ * The storage is a log at the end of the flash. Every record takes one flash
+ * page and is appended behind the last one, the newest record of a key wins.
+ * The sector after the one the log writes into is kept erased. Before it is
+ * erased, the records in there that are still the newest of their key are
+ * written again at the head of the log, so a key always has a valid record
+ * somewhere, even when power is lost in between. This way every sector is
+ * erased once per round through the log and not on every save.
+ */
+#define STORAGE_SECTORS 4
+#define STORAGE_SIZE (STORAGE_SECTORS * FLASH_SECTOR_SIZE)
+#define STORAGE_OFFSET (PICO_FLASH_SIZE_BYTES - STORAGE_SIZE)
+#define STORAGE_PAGES (STORAGE_SIZE / FLASH_PAGE_SIZE)
+#define STORAGE_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define STORAGE_MAGIC 0x50434d4c /* "PCML" */
+#define STORAGE_NONE 0xffff
+
+struct storage_record {
+    uint32_t magic;
+    uint8_t key;
+    uint8_t reserved;
+    uint16_t len;
+    uint32_t seq;
+    uint32_t crc;   /* over key, len, seq and data */
+    uint8_t data[STORAGE_RECORD_MAX];
+};
+
+_Static_assert(sizeof(struct storage_record) == FLASH_PAGE_SIZE, "a storage record takes one flash page");
+_Static_assert(STORAGE_KEYS < STORAGE_PAGES_PER_SECTOR, "all keys must fit into one sector");
+_Static_assert(STORAGE_SECTORS >= 2, "the log needs a sector to move on into");
+
+static bool scanned = false;
+static uint16_t latest[STORAGE_KEYS];   /* page of the newest record of each key */
+static uint16_t head;                   /* next page to write */
+static uint32_t next_seq;
+
+static const struct storage_record *storage_page(uint16_t page) {
+    /* flash is memory mapped */
+    return (const struct storage_record *)(XIP_BASE + STORAGE_OFFSET + page * FLASH_PAGE_SIZE);
+}
+
+uint32_t storage_crc32(const void *data, uint16_t len) {
+    const uint8_t *p = data;
+    uint32_t crc = 0xffffffff;
+
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t storage_record_crc(const struct storage_record *rec) {
+    /* key, reserved, len and seq are right behind the magic */
+    uint8_t buf[8 + STORAGE_RECORD_MAX];
+
+    memcpy(buf, &rec->key, 8);
+    memcpy(buf + 8, rec->data, rec->len);
+    return storage_crc32(buf, 8 + rec->len);
+}
+
+static bool storage_record_valid(const struct storage_record *rec) {
+    return rec->magic == STORAGE_MAGIC && rec->key < STORAGE_KEYS &&
+           rec->len <= STORAGE_RECORD_MAX && rec->crc == storage_record_crc(rec);
+}
+
+static bool storage_page_erased(uint16_t page) {
+    const uint32_t *p = (const uint32_t *)storage_page(page);
+
+    for (uint i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (p[i] != 0xffffffff)
+            return false;
+    }
+    return true;
+}
+
+/* find the newest record of every key and the end of the log */
+static void storage_scan(void) {
+    uint32_t newest = 0;
+    bool found = false;
+
+    for (uint8_t key = 0; key < STORAGE_KEYS; key++)
+        latest[key] = STORAGE_NONE;
+    head = 0;
+    next_seq = 1;
+
+    for (uint16_t page = 0; page < STORAGE_PAGES; page++) {
+        const struct storage_record *rec = storage_page(page);
+
+        if (!storage_record_valid(rec))
+            continue;
+        if (latest[rec->key] == STORAGE_NONE || (int32_t)(rec->seq - storage_page(latest[rec->key])->seq) > 0)
+            latest[rec->key] = page;
+        if (!found || (int32_t)(rec->seq - newest) > 0) {
+            newest = rec->seq;
+            head = (page + 1) % STORAGE_PAGES;
+            found = true;
+        }
+    }
+    if (found)
+        next_seq = newest + 1;
+    scanned = true;
+}
+
+static bool storage_sector_erased(uint16_t sector) {
+    for (uint16_t i = 0; i < STORAGE_PAGES_PER_SECTOR; i++) {
+        if (!storage_page_erased(sector * STORAGE_PAGES_PER_SECTOR + i))
+            return false;
+    }
+    return true;
+}
+
+/* program one page, core 1 is parked and interrupts are off meanwhile */
+static void storage_program(uint16_t page, const uint8_t *buf) {
+    uint32_t ints;
+
+    multicore_lockout_start_blocking();
+    ints = save_and_disable_interrupts();
+    flash_range_program(STORAGE_OFFSET + page * FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+static void storage_erase(uint16_t sector) {
+    uint32_t ints;
+
+    multicore_lockout_start_blocking();
+    ints = save_and_disable_interrupts();
+    flash_range_erase(STORAGE_OFFSET + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    multicore_lockout_end_blocking();
+}
+
+/*
+ * Write a record at the next erased page of sector and make it the newest of
+ * its key once it reads back valid. Pages that were left half written, e.g.
+ * by a power loss, are skipped.
+ */
+static bool storage_write(uint16_t sector, const struct storage_record *rec_in) {
+    static struct storage_record rec;
+
+    if (head / STORAGE_PAGES_PER_SECTOR != sector)
+        head = sector * STORAGE_PAGES_PER_SECTOR;
+    while (!storage_page_erased(head)) {
+        head = (head + 1) % STORAGE_PAGES;
+        if (head / STORAGE_PAGES_PER_SECTOR != sector)
+            return false;
+    }
+
+    memcpy(&rec, rec_in, FLASH_PAGE_SIZE);
+    rec.seq = next_seq++;
+    rec.crc = storage_record_crc(&rec);
+    storage_program(head, (const uint8_t *)&rec);
+    if (!storage_record_valid(storage_page(head)))
+        return false;
+    latest[rec.key] = head;
+    head = (head + 1) % STORAGE_PAGES;
+    return true;
+}
+
+/* write a record at the head of the log */
+static bool storage_append(const struct storage_record *rec_in) {
+    uint16_t sector = head / STORAGE_PAGES_PER_SECTOR;
+    uint16_t spare = (sector + 1) % STORAGE_SECTORS;
+
+    /*
+     * Move the newest records out of the next sector before it is erased.
+     * This happens right after the log went into sector, so there is room for
+     * all keys. On any failure nothing is erased and latest[] stays valid.
+     */
+    if (!storage_sector_erased(spare)) {
+        for (uint8_t key = 0; key < STORAGE_KEYS; key++) {
+            if (latest[key] == STORAGE_NONE || latest[key] / STORAGE_PAGES_PER_SECTOR != spare)
+                continue;
+            if (!storage_write(sector, storage_page(latest[key])))
+                return false;
+        }
+        storage_erase(spare);
+    }
+
+    /* when sector is full the log goes on in the one just erased */
+    return storage_write(sector, rec_in) || storage_write(spare, rec_in);
+}
+
+bool storage_load(uint8_t key, void *data, uint16_t len) {
+    const struct storage_record *rec;
+
+    if (key >= STORAGE_KEYS || len > STORAGE_RECORD_MAX)
+        return false;
+    if (!scanned)
+        storage_scan();
+    if (latest[key] == STORAGE_NONE)
+        return false;
+    rec = storage_page(latest[key]);
+    if (rec->len != len)
+        return false;
+    memcpy(data, rec->data, len);
+    return true;
+}
+
+bool storage_save(uint8_t key, const void *data, uint16_t len) {
+    static struct storage_record rec;
+
+    if (key >= STORAGE_KEYS || len > STORAGE_RECORD_MAX)
+        return false;
+    if (!scanned)
+        storage_scan();
+
+    memset(&rec, 0xff, sizeof(rec));
+    rec.magic = STORAGE_MAGIC;
+    rec.key = key;
+    rec.reserved = 0;
+    rec.len = len;
+    memcpy(rec.data, data, len);
+    return storage_append(&rec);
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Settings that survive a power cycle, kept in a wear levelled log at the end
+ * of the flash (see storage.c).
+ * Every record has a key, a length and a CRC. Records that do not check out
+ * are treated like missing ones, so the caller falls back to its defaults.
+ */
+
+/* calibration curves have one key per meter */
+#define STORAGE_CALIBRATION_KEYS 8
+
+enum storage_key {
+    STORAGE_KEY_MAPPING = 0,
+    STORAGE_KEY_CALIBRATION,
+    STORAGE_KEYS = STORAGE_KEY_CALIBRATION + STORAGE_CALIBRATION_KEYS,
+};
+
+/* largest record that can be stored */
+#define STORAGE_RECORD_MAX 240
+
+/* returns true and fills data if a valid record of exactly len bytes was found */
+bool storage_load(uint8_t key, void *data, uint16_t len);
+/*
+ * Write a record. This may erase a flash sector and takes some ms, do not
+ * call it from a USB callback. Core 1 is paused while the flash is written.
+ */
+bool storage_save(uint8_t key, const void *data, uint16_t len);
+uint32_t storage_crc32(const void *data, uint16_t len);
+
+#endif // STORAGE_H_
@@ -2,12 +2,21 @@
 /* Pascal Jaeger, 2023 */
 
 #include <stdlib.h>
+#include <string.h>
 #ifdef DEBUG
  #include <stdio.h>
 #endif
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/time.h"
 #include "WS2812.pio.h"
 #include "ws2812.h"
 
+/* a WS2812 latches the data after the line is low for more than 50us */
+#define WS2812_RESET_US 60
+/* the joined TX FIFO and the OSR can still hold this many pixels when the DMA is done */
+#define WS2812_FIFO_PIXELS 9
+
 struct WS2812 {
     PIO pio;
     int16_t sm;
@@ -15,9 +24,92 @@ struct WS2812 {
     bool is_rgbw;
     uint16_t offset;
     uint16_t length;
-    uint32_t* data;
+    uint32_t* data;         /* frame that is drawn into */
+    uint32_t* tx;           /* frame the DMA is sending */
+    int dma_chan;
+    volatile bool busy;
+    uint32_t latch_us;
+    ws2812_done_cb done_cb;
+    void* done_data;
+};
+
+struct WS2812_group {
+    uint8_t count;
+    struct WS2812* strips[WS2812_GROUP_MAX];
 };
 
+/* the ws2812 program is loaded once per PIO and shared by all its state machines */
+static uint16_t program_offset[NUM_PIOS];
+static uint8_t program_users[NUM_PIOS];
+
+/* strips with a DMA channel, indexed by channel, for the shared DMA IRQ handler */
+static struct WS2812* dma_strips[NUM_DMA_CHANNELS];
+static bool dma_irq_installed = false;
+static alarm_pool_t* latch_pool = NULL;
+
+static int64_t ws2812_latch_done(alarm_id_t id, void* user_data) {
+    struct WS2812* led_strip = user_data;
+    (void) id;
+
+    led_strip->busy = false;
+    if (led_strip->done_cb)
+        led_strip->done_cb(led_strip, led_strip->done_data);
+    return 0;
+}
+
+static void ws2812_dma_irq_handler(void) {
+    for (int chan = 0; chan < NUM_DMA_CHANNELS; chan++) {
+        struct WS2812* led_strip = dma_strips[chan];
+
+        if (!led_strip || !dma_channel_get_irq0_status(chan))
+            continue;
+        dma_channel_acknowledge_irq0(chan);
+        /* the last pixels are still in the FIFO, wait for them plus the reset time */
+        if (alarm_pool_add_alarm_in_us(latch_pool ? latch_pool : alarm_pool_get_default(),
+                                       led_strip->latch_us, ws2812_latch_done, led_strip, true) < 0)
+            ws2812_latch_done(0, led_strip);
+    }
+}
+
+static uint16_t ws2812_program_get(PIO pio) {
+    uint idx = pio_get_index(pio);
+
+    if (program_users[idx]++ == 0)
+        program_offset[idx] = pio_add_program(pio, &ws2812_program);
+    return program_offset[idx];
+}
+
+static void ws2812_program_put(PIO pio) {
+    uint idx = pio_get_index(pio);
+
+    if (program_users[idx] && --program_users[idx] == 0)
+        pio_remove_program(pio, &ws2812_program, program_offset[idx]);
+}
+
+static void ws2812_dma_init(struct WS2812* led_strip) {
+    dma_channel_config c;
+
+    led_strip->dma_chan = dma_claim_unused_channel(false);
+    if (led_strip->dma_chan < 0)
+        return;
+
+    c = dma_channel_get_default_config(led_strip->dma_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(led_strip->pio, led_strip->sm, true));
+    dma_channel_configure(led_strip->dma_chan, &c, &led_strip->pio->txf[led_strip->sm],
+                          NULL, led_strip->length, false);
+
+    dma_strips[led_strip->dma_chan] = led_strip;
+    dma_channel_set_irq0_enabled(led_strip->dma_chan, true);
+    if (!dma_irq_installed) {
+        irq_add_shared_handler(DMA_IRQ_0, ws2812_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_0, true);
+        dma_irq_installed = true;
+    }
+}
+
 uint32_t ws2812_urgb_grbu32(uint8_t r, uint8_t g, uint8_t b) {
     return
             ((uint32_t) (g) << 24) |
@@ -47,7 +139,7 @@ int8_t ws2812_set_led(struct WS2812* led_strip, uint16_t idx, uint32_t pixel_dat
 #endif
         return -1;
     }
-    if (idx > led_strip->length) {
+    if (idx >= led_strip->length) {
 #ifdef DEBUG
         printf("set_led: index %d geater than led_strip's length %d\n", idx, led_strip->length);
 #endif
@@ -76,6 +168,9 @@ int8_t ws2812_show(struct WS2812* led_strip) {
 #endif
         return -1;
     }
+    /* do not mix into a frame that is still going out via DMA */
+    while (led_strip->busy)
+        tight_loop_contents();
     for (uint16_t i = 0; i < led_strip->length; i++)
     {
 #ifdef DEBUG
@@ -86,6 +181,56 @@ int8_t ws2812_show(struct WS2812* led_strip) {
     return 1;
 }
 
+/* swap buffers, drawing goes on with a copy of the frame being sent */
+static void ws2812_swap_frame(struct WS2812* led_strip) {
+    uint32_t* frame = led_strip->tx;
+
+    led_strip->tx = led_strip->data;
+    led_strip->data = frame;
+    memcpy(led_strip->data, led_strip->tx, led_strip->length * sizeof(uint32_t));
+    led_strip->busy = true;
+}
+
+int8_t ws2812_show_async(struct WS2812* led_strip) {
+    if (!led_strip) {
+#ifdef DEBUG
+        printf("ws2812_show_async: led_strip is NULL\n");
+#endif
+        return -1;
+    }
+    /* no DMA channel was free, send it the slow way */
+    if (led_strip->dma_chan < 0)
+        return ws2812_show(led_strip);
+    if (led_strip->busy)
+        return -1;
+
+    ws2812_swap_frame(led_strip);
+    dma_channel_set_read_addr(led_strip->dma_chan, led_strip->tx, true);
+    return 1;
+}
+
+bool ws2812_is_busy(struct WS2812* led_strip) {
+    if (!led_strip)
+        return false;
+    return led_strip->busy;
+}
+
+int8_t ws2812_set_done_callback(struct WS2812* led_strip, ws2812_done_cb cb, void* user_data) {
+    if (!led_strip) {
+#ifdef DEBUG
+        printf("ws2812_set_done_callback: led_strip is NULL\n");
+#endif
+        return -1;
+    }
+    led_strip->done_cb = cb;
+    led_strip->done_data = user_data;
+    return 0;
+}
+
+void ws2812_set_alarm_pool(alarm_pool_t* pool) {
+    latch_pool = pool;
+}
+
 uint16_t ws2812_get_length(struct WS2812* led_strip) {
     if (!led_strip) {
 #ifdef DEBUG
@@ -143,7 +288,11 @@ uint32_t ws2812_get_pixel_data(struct WS2812* led_strip, uint16_t idx) {
 }
 
 struct WS2812* ws2812_initialize(PIO pio, uint16_t sm, uint8_t pin, uint16_t length, bool is_rgbw) {
-   struct WS2812* led_strip = malloc(sizeof(struct WS2812));
+   struct WS2812* led_strip;
+
+   if (pio_sm_is_claimed(pio, sm))
+       return NULL;
+   led_strip = malloc(sizeof(struct WS2812));
    if (!led_strip)
        return NULL;
    led_strip->pio = pio;
@@ -151,9 +300,23 @@ struct WS2812* ws2812_initialize(PIO pio, uint16_t sm, uint8_t pin, uint16_t len
    led_strip->pin = pin;
    led_strip->length = length;
    led_strip->is_rgbw = is_rgbw;
-   led_strip->data = malloc(length * sizeof(uint32_t));
-   led_strip->offset = pio_add_program(led_strip->pio, &ws2812_program);
+   led_strip->data = calloc(length, sizeof(uint32_t));
+   led_strip->tx = calloc(length, sizeof(uint32_t));
+   if (!led_strip->data || !led_strip->tx) {
+       free(led_strip->data);
+       free(led_strip->tx);
+       free(led_strip);
+       return NULL;
+   }
+   led_strip->busy = false;
+   led_strip->done_cb = NULL;
+   led_strip->done_data = NULL;
+   /* time one pixel needs on the wire at 800kHz is bits * 1.25us */
+   led_strip->latch_us = WS2812_FIFO_PIXELS * (is_rgbw ? 32 : 24) * 5 / 4 + WS2812_RESET_US;
+   pio_sm_claim(pio, sm);
+   led_strip->offset = ws2812_program_get(led_strip->pio);
    ws2812_program_init(led_strip->pio, led_strip->sm, led_strip->offset, led_strip->pin, 800000, led_strip->is_rgbw? 32 : 24);
+   ws2812_dma_init(led_strip);
    return led_strip;
 }
 
@@ -164,8 +327,126 @@ int8_t ws2812_destroy(struct WS2812* led_strip) {
 #endif
         return -1;
     }
-    pio_remove_program(led_strip->pio, &ws2812_program, led_strip->offset);
+    while (led_strip->busy)
+        tight_loop_contents();
+    if (led_strip->dma_chan >= 0) {
+        dma_channel_set_irq0_enabled(led_strip->dma_chan, false);
+        dma_strips[led_strip->dma_chan] = NULL;
+        dma_channel_unclaim(led_strip->dma_chan);
+    }
+    pio_sm_set_enabled(led_strip->pio, led_strip->sm, false);
+    pio_sm_unclaim(led_strip->pio, led_strip->sm);
+    ws2812_program_put(led_strip->pio);
     free(led_strip->data);
+    free(led_strip->tx);
     free(led_strip);
     return 0;
 }
+
+struct WS2812_group* ws2812_group_initialize(const uint8_t* pins, const uint16_t* lengths, uint8_t count, bool is_rgbw) {
+    struct WS2812_group* group;
+
+    if (!pins || !lengths || count == 0 || count > WS2812_GROUP_MAX)
+        return NULL;
+    group = calloc(1, sizeof(struct WS2812_group));
+    if (!group)
+        return NULL;
+
+    for (uint8_t i = 0; i < count; i++) {
+        /* fill up pio0 first, then go on with pio1 */
+        PIO pio = pio0;
+        int sm = pio_claim_unused_sm(pio, false);
+
+        if (sm < 0) {
+            pio = pio1;
+            sm = pio_claim_unused_sm(pio, false);
+        }
+        if (sm < 0) {
+#ifdef DEBUG
+            printf("ws2812_group_initialize: no free state machine for strip %d\n", i);
+#endif
+            ws2812_group_destroy(group);
+            return NULL;
+        }
+        /* ws2812_initialize claims the state machine itself */
+        pio_sm_unclaim(pio, sm);
+        group->strips[i] = ws2812_initialize(pio, sm, pins[i], lengths[i], is_rgbw);
+        if (!group->strips[i]) {
+            ws2812_group_destroy(group);
+            return NULL;
+        }
+        group->count++;
+    }
+    return group;
+}
+
+struct WS2812* ws2812_group_get_strip(struct WS2812_group* group, uint8_t idx) {
+    if (!group || idx >= group->count) {
+#ifdef DEBUG
+        printf("ws2812_group_get_strip: no strip %d in group\n", idx);
+#endif
+        return NULL;
+    }
+    return group->strips[idx];
+}
+
+uint8_t ws2812_group_get_count(struct WS2812_group* group) {
+    if (!group)
+        return 0;
+    return group->count;
+}
+
+int8_t ws2812_group_show(struct WS2812_group* group) {
+    uint32_t mask = 0;
+
+    if (!group) {
+#ifdef DEBUG
+        printf("ws2812_group_show: group is NULL\n");
+#endif
+        return -1;
+    }
+    if (ws2812_group_is_busy(group))
+        return -1;
+
+    for (uint8_t i = 0; i < group->count; i++) {
+        struct WS2812* led_strip = group->strips[i];
+
+        if (led_strip->dma_chan < 0)
+            continue;
+        ws2812_swap_frame(led_strip);
+        dma_channel_set_read_addr(led_strip->dma_chan, led_strip->tx, false);
+        mask |= 1u << led_strip->dma_chan;
+    }
+    /* all strips start clocking out at the same time */
+    dma_start_channel_mask(mask);
+
+    /* strips that did not get a DMA channel go the slow way */
+    for (uint8_t i = 0; i < group->count; i++) {
+        if (group->strips[i]->dma_chan < 0)
+            ws2812_show(group->strips[i]);
+    }
+    return 1;
+}
+
+bool ws2812_group_is_busy(struct WS2812_group* group) {
+    if (!group)
+        return false;
+    for (uint8_t i = 0; i < group->count; i++) {
+        if (group->strips[i]->busy)
+            return true;
+    }
+    return false;
+}
+
+int8_t ws2812_group_destroy(struct WS2812_group* group) {
+    if (!group) {
+#ifdef DEBUG
+        printf("ws2812_group_destroy: group is NULL\n");
+#endif
+        return -1;
+    }
+    for (uint8_t i = 0; i < group->count; i++)
+        ws2812_destroy(group->strips[i]);
+    free(group);
+    return 0;
+}
@@ -4,7 +4,16 @@
 #ifndef WS2812_H_
 #define WS2812_H_
 
+#include "pico/time.h"
+
 struct WS2812;
+struct WS2812_group;
+
+/* 4 state machines on each of the 2 PIOs */
+#define WS2812_GROUP_MAX 8
+
+/* called from interrupt context once a frame sent by ws2812_show_async() is latched */
+typedef void (*ws2812_done_cb)(struct WS2812 *led_strip, void *user_data);
 
 /*
  * Use these function to create a pixel data.
@@ -24,14 +33,42 @@ int8_t ws2812_set_led(struct WS2812 *led_strip, uint16_t idx, uint32_t pixel_dat
 /*  set the color of all LEDs of a strip at once */
 int8_t ws2812_fill(struct WS2812 *led_strip, uint32_t pixel_data);
 
-/* write the data to the LED strip */
+/* write the data to the LED strip, blocks until all pixels are in the PIO */
 int8_t ws2812_show(struct WS2812 *led_strip);
+/*
+ * Start sending the data to the LED strip via DMA and return right away.
+ * Frames are double-buffered, so drawing the next frame can start at once.
+ * Returns -1 if the previous frame is still being sent.
+ * Falls back to ws2812_show() if there was no free DMA channel.
+ */
+int8_t ws2812_show_async(struct WS2812 *led_strip);
+/* true from ws2812_show_async() until the frame is latched by the LEDs */
+bool ws2812_is_busy(struct WS2812 *led_strip);
+/* set a function to call when a frame is latched, cb may be NULL */
+int8_t ws2812_set_done_callback(struct WS2812 *led_strip, ws2812_done_cb cb, void *user_data);
+/* alarm pool for the reset latch timing, its IRQ runs on the core that created it (default: core 0) */
+void ws2812_set_alarm_pool(alarm_pool_t *pool);
 
 /* create a new LED strip object */
 struct WS2812* ws2812_initialize(PIO pio, uint16_t sm, uint8_t pin, uint16_t length, bool is_rgbw);
 /* destroy the LED strip object */
 int8_t ws2812_destroy(struct WS2812 *led_strip);
 
+/*
+ * Strip groups: several strips on separate pins that are sent out in parallel.
+ * The ws2812 program is loaded only once per PIO, each strip gets its own
+ * state machine (pio0 first, then pio1) and DMA channel.
+ */
+/* create count strips, strip i is on pins[i] and lengths[i] LEDs long */
+struct WS2812_group* ws2812_group_initialize(const uint8_t *pins, const uint16_t *lengths, uint8_t count, bool is_rgbw);
+/* the strips of a group are drawn into with the single strip functions */
+struct WS2812* ws2812_group_get_strip(struct WS2812_group *group, uint8_t idx);
+uint8_t ws2812_group_get_count(struct WS2812_group *group);
+/* send the current frame of all strips at once, returns -1 while the last one is being sent */
+int8_t ws2812_group_show(struct WS2812_group *group);
+bool ws2812_group_is_busy(struct WS2812_group *group);
+int8_t ws2812_group_destroy(struct WS2812_group *group);
+
 /* getters */
 uint16_t ws2812_get_length(struct WS2812 *led_strip);
 uint8_t ws2812_get_pin(struct WS2812 *led_strip);
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/* Pascal Jaeger, 2024 */
+
+#ifndef PCMETER_PROTOCOL_H_
+#define PCMETER_PROTOCOL_H_
+
+/*
+ * Wire protocol between the PC side (kernel module, pc-meterd) and the
+ * pcmeter-pico. Shared by the kernel module and the firmware, the daemon
+ * has the same constants in src/protocol.rs.
+ *
+ * All offsets are counted like on the PC side: byte 0 is the HID report
+ * number (always 0), tinyusb cuts it off, so byte n here is buffer[n - 1]
+ * in the firmware. Multi byte values are little endian.
+ *
+ * Legacy reports (v1)
+ *   [1] report id (PCM_REPORT_SYSTEM, PCM_REPORT_USER), [2..63] one byte
+ *   per value, see the Readmes of kernel module and daemon for the layout.
+ *
+ * v2 reports
+ *   [1]    PCM_REPORT_V2, no legacy report uses this id
+ *   [2]    protocol version, PCM_V2_VERSION
+ *   [3]    stream, one per sender (PCM_STREAM_*), sequence numbers are
+ *          counted per stream
+ *   [4]    flags, PCM_V2_FLAG_*
+ *   [5-6]  sequence number, +1 for every report of the stream
+ *   [7-10] timestamp of the sender in ms, wraps around
+ *   [11..] TLVs until PCM_TLV_END or the end of the report
+ *
+ *   A TLV is [0] type, [1] length of the value, [2..] value. Receivers skip
+ *   types they do not know.
+ *   PCM_TLV_VALUES  [0] report id, [1] byte of the first value,
+ *                   [2-3] age of the values in ms (before the timestamp),
+ *                   [4..] 16 bit values for byte, byte + 1, ...
+ *   A value is the legacy value at that byte in Q8.8: a CPU load of 45.5%
+ *   at byte 2 of the system report is 0x2d80, a load average of 1.5 is 0x0180.
+ *   PCM_TLV_CORES   load of every CPU core, for any number of cores
+ *                   [0-1] frame, +1 for every sample of all cores
+ *                   [2] part of the frame, [3] number of parts
+ *                   [4-5] number of cores, [6] PCM_CORES_FLAG_*
+ *                   [7..] runs: [0-1] first core, [2] n, [3..] n loads
+ *   The per-core loads of one sample (a frame) are split over as many
+ *   reports (parts) as they need. A load is percent in one byte. Only the
+ *   cores that changed since the last frame are sent, cores that are not in
+ *   any run keep their load. Every PCM_CORES_KEYFRAME frames, and after
+ *   PCM_V2_FLAG_RESET, all cores are sent (PCM_CORES_FLAG_FULL), so lost
+ *   reports do not leave wrong values behind for long. The receiver takes
+ *   a frame only when all its parts arrived.
+ *
+ * Capabilities
+ *   The host sends the feature report [1] PCM_FEATURE_CMD_CAPS and reads the
+ *   answer back with GET_REPORT (feature):
+ *   [1] PCM_FEATURE_CMD_CAPS, [2] status (0 is ok), [3] PCM_CAP_* bits,
+ *   [4] highest v2 version understood, [5] report size,
+ *   [6-9] reports received, [10-13] reports lost, [14-17] reports out of order,
+ *   [18-19] number of cores of the last complete frame,
+ *   [20-23] core frames dropped because a part was missing.
+ *   A device that does not answer only understands legacy reports.
+ */
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define PCM_REPORT_SIZE 64
+
+/* byte 1 */
+#define PCM_REPORT_SYSTEM 0x00
+#define PCM_REPORT_USER 0x01
+#define PCM_REPORT_KERNEL 0x02  /* only sent as v2 */
+#define PCM_REPORT_IO 0x03      /* only sent as v2 */
+#define PCM_REPORT_V2 0xa2
+
+/* layout of the legacy reports, v2 values use the same positions */
+#define PCM_SYS_CPU 2           /* overall CPU load */
+#define PCM_SYS_MEM 3           /* memory usage */
+#define PCM_SYS_CPUS 4          /* number of online CPUs */
+#define PCM_SYS_CORE0 10        /* load of CPU 0, CPU n is at PCM_SYS_CORE0 + n */
+#define PCM_USER_SWAP 2         /* swap usage */
+/*
+ * load averages: the integer part (legacy) or the whole value (v2), the byte
+ * behind each is the fraction in hundredths
+ */
+#define PCM_USER_LOAD1 3
+#define PCM_USER_LOAD5 5
+#define PCM_USER_LOAD15 7
+#define PCM_USER_DISKS 9        /* number of disks */
+#define PCM_USER_DISK0 10       /* usage of disks 0-9 */
+#define PCM_USER_TEMP0 20       /* temperature of components 0-19 */
+/* kernel report, shares of all CPU time in percent */
+#define PCM_KERN_IOWAIT 2
+#define PCM_KERN_STEAL 3
+#define PCM_KERN_IRQ 4
+#define PCM_KERN_SOFTIRQ 5
+#define PCM_KERN_NODES 6        /* number of online NUMA nodes */
+#define PCM_KERN_NODE0 10       /* memory of NUMA node n that is not free at PCM_KERN_NODE0 + n */
+/* I/O report, throughput in percent of the line rate or the most a disk does */
+#define PCM_IO_DISKS 2          /* number of disks */
+#define PCM_IO_NETS 3           /* number of NICs */
+#define PCM_IO_DISK_BUSIEST 4   /* highest utilisation of all disks */
+#define PCM_IO_NET_BUSIEST 5    /* highest rx or tx of all NICs */
+/* disk n at PCM_IO_DISK0 + n * PCM_IO_DISK_STRIDE + PCM_IO_DISK_* */
+#define PCM_IO_DISK0 10
+#define PCM_IO_DISK_STRIDE 4
+#define PCM_IO_DISK_UTIL 0      /* share of the time the disk was busy */
+#define PCM_IO_DISK_READ 1
+#define PCM_IO_DISK_WRITE 2
+#define PCM_IO_DISK_IOPS 3
+#define PCM_IO_DISKS_MAX 8
+/* NIC n at PCM_IO_NET0 + n * PCM_IO_NET_STRIDE + PCM_IO_NET_* */
+#define PCM_IO_NET0 42
+#define PCM_IO_NET_STRIDE 2
+#define PCM_IO_NET_RX 0
+#define PCM_IO_NET_TX 1
+#define PCM_IO_NETS_MAX 10
+
+/* v2 header */
+#define PCM_V2_VERSION 2
+#define PCM_V2_OFF_VERSION 2
+#define PCM_V2_OFF_STREAM 3
+#define PCM_V2_OFF_FLAGS 4
+#define PCM_V2_OFF_SEQ 5
+#define PCM_V2_OFF_TIME 7
+#define PCM_V2_OFF_TLV 11
+
+#define PCM_V2_FLAG_RESET 0x01  /* first report after the sender started, restart the sequence */
+
+enum {
+	PCM_STREAM_KERNEL = 0,
+	PCM_STREAM_DAEMON = 1,
+	PCM_STREAMS = 4,        /* streams the receiver tracks sequence numbers for */
+};
+
+/* TLVs */
+#define PCM_TLV_END 0x00
+#define PCM_TLV_VALUES 0x01
+#define PCM_TLV_CORES 0x02
+#define PCM_TLV_HDR 2
+#define PCM_TLV_VALUES_HDR 4
+
+/* PCM_TLV_CORES */
+#define PCM_CORES_HDR 7
+#define PCM_CORES_OFF_PARTS 3
+#define PCM_CORES_RUN_HDR 3
+#define PCM_CORES_FLAG_FULL 0x01
+#define PCM_CORES_MAX 512       /* most cores a receiver has to keep */
+#define PCM_CORES_PARTS_MAX 32  /* most reports a frame may take */
+#define PCM_CORES_KEYFRAME 16
+/* unchanged cores between two changed ones that are sent instead of starting a new run */
+#define PCM_CORES_GAP PCM_CORES_RUN_HDR
+
+/* capabilities */
+#define PCM_FEATURE_CMD_CAPS 0x02
+#define PCM_CAPS_OFF_STATUS 2
+#define PCM_CAPS_OFF_CAPS 3
+#define PCM_CAPS_OFF_VERSION 4
+#define PCM_CAPS_OFF_SIZE 5
+#define PCM_CAPS_OFF_FRAMES 6
+#define PCM_CAPS_OFF_LOST 10
+#define PCM_CAPS_OFF_REORDERED 14
+#define PCM_CAPS_OFF_CORES 18
+#define PCM_CAPS_OFF_CORES_DROPPED 20
+#define PCM_CAPS_LEN 18         /* shortest answer a host has to accept */
+
+#define PCM_CAP_LEGACY 0x01
+#define PCM_CAP_V2 0x02
+#define PCM_CAP_CORES 0x04      /* understands PCM_TLV_CORES */
+
+static inline void pcm_put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static inline void pcm_put_le32(uint8_t *p, uint32_t v)
+{
+	pcm_put_le16(p, v & 0xffff);
+	pcm_put_le16(p + 2, v >> 16);
+}
+
+static inline uint16_t pcm_get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t pcm_get_le32(const uint8_t *p)
+{
+	return pcm_get_le16(p) | ((uint32_t)pcm_get_le16(p + 2) << 16);
+}
+
+/* start a v2 report in buf (PCM_REPORT_SIZE bytes), returns the offset of the first TLV */
+static inline int pcm_v2_begin(uint8_t *buf, uint8_t stream, uint8_t flags, uint16_t seq, uint32_t time_ms)
+{
+	int i;
+
+	for (i = 0; i < PCM_REPORT_SIZE; i++)
+		buf[i] = 0;
+	buf[1] = PCM_REPORT_V2;
+	buf[PCM_V2_OFF_VERSION] = PCM_V2_VERSION;
+	buf[PCM_V2_OFF_STREAM] = stream;
+	buf[PCM_V2_OFF_FLAGS] = flags;
+	pcm_put_le16(&buf[PCM_V2_OFF_SEQ], seq);
+	pcm_put_le32(&buf[PCM_V2_OFF_TIME], time_ms);
+	return PCM_V2_OFF_TLV;
+}
+
+/*
+ * Append a PCM_TLV_VALUES at off with as many of the count values as fit.
+ * Returns how many were written, *off is moved behind the TLV.
+ * The rest of the report stays 0, which reads as PCM_TLV_END.
+ */
+static inline int pcm_v2_values(uint8_t *buf, int *off, uint8_t report, uint8_t first,
+				uint16_t age_ms, const uint16_t *values, int count)
+{
+	int room = (PCM_REPORT_SIZE - *off - PCM_TLV_HDR - PCM_TLV_VALUES_HDR) / 2;
+	uint8_t *p = &buf[*off];
+	int i;
+
+	if (room <= 0)
+		return 0;
+	if (count > room)
+		count = room;
+	p[0] = PCM_TLV_VALUES;
+	p[1] = PCM_TLV_VALUES_HDR + count * 2;
+	p[2] = report;
+	p[3] = first;
+	pcm_put_le16(&p[4], age_ms);
+	for (i = 0; i < count; i++)
+		pcm_put_le16(&p[PCM_TLV_HDR + PCM_TLV_VALUES_HDR + i * 2], values[i]);
+	*off += PCM_TLV_HDR + p[1];
+	return count;
+}
+
+/*
+ * Append a PCM_TLV_CORES at off with the runs of the cores from *core on that
+ * differ from prev, or all of them if prev is NULL. Fills the report as far
+ * as it goes, *core is moved to the first core that did not fit and is
+ * ncores when all are done. The number of parts is not known yet, the
+ * sender writes it to PCM_CORES_OFF_PARTS of every part when the frame is
+ * complete, *parts_at is where.
+ */
+static inline void pcm_v2_cores(uint8_t *buf, int *off, int *parts_at, uint16_t frame, uint8_t part,
+				uint16_t ncores, uint8_t flags, const uint8_t *load, const uint8_t *prev,
+				uint16_t *core)
+{
+	uint8_t *p = &buf[*off];
+	int len = PCM_CORES_HDR;
+	int room = PCM_REPORT_SIZE - *off - PCM_TLV_HDR;
+	uint16_t c = *core;
+
+	if (room > 255)
+		room = 255;
+	p[0] = PCM_TLV_CORES;
+	pcm_put_le16(&p[2], frame);
+	p[4] = part;
+	p[5] = 0;
+	pcm_put_le16(&p[6], ncores);
+	p[8] = flags;
+	*parts_at = *off + PCM_TLV_HDR + PCM_CORES_OFF_PARTS;
+
+	while (c < ncores) {
+		uint16_t end, gap;
+		uint8_t *run;
+
+		/* next core that changed */
+		if (prev && load[c] == prev[c]) {
+			c++;
+			continue;
+		}
+		if (len + PCM_CORES_RUN_HDR + 1 > room)
+			break;
+
+		/* grow the run over changed cores and short gaps of unchanged ones */
+		end = c + 1;
+		while (end < ncores) {
+			gap = 0;
+			while (prev && end + gap < ncores && gap <= PCM_CORES_GAP &&
+			       load[end + gap] == prev[end + gap])
+				gap++;
+			if (end + gap >= ncores || gap > PCM_CORES_GAP)
+				break;
+			if (len + PCM_CORES_RUN_HDR + (end + gap + 1 - c) > room || end + gap + 1 - c > 255)
+				break;
+			end += gap + 1;
+		}
+
+		run = &p[PCM_TLV_HDR + len];
+		pcm_put_le16(&run[0], c);
+		run[2] = end - c;
+		for (gap = 0; gap < end - c; gap++)
+			run[PCM_CORES_RUN_HDR + gap] = load[c + gap];
+		len += PCM_CORES_RUN_HDR + (end - c);
+		c = end;
+	}
+
+	p[1] = len;
+	*off += PCM_TLV_HDR + len;
+	*core = c;
+}
+
+#endif // PCMETER_PROTOCOL_H_